@@ -0,0 +1,233 @@
+/***********************************************************
+ * This file is part of glyr
+ * + a commnadline tool and library to download various sort of music related metadata.
+ * + Copyright (C) [2011]  [Christopher Pahl]
+ * + Hosted at: https://github.com/sahib/glyr
+ *
+ * glyr is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * glyr is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with glyr. If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************/
+
+/* A small feedback controller for the number of parallel queried providers
+ * and the per-transfer timeouts. It learns from what async_download() observes,
+ * the parallelism per get type, the timeouts per get type and host (~ provider),
+ * and is only asked if a query enabled it.
+ */
+
+#include "autotune.h"
+#include "core.h"
+
+/////////////////////////////////
+
+typedef struct
+{
+    /* Fraction of the providers in a wave that delivered anything */
+    gdouble success_rate;
+    gint waves;
+
+    /* Seconds till the first usable result of a wave came in */
+    gdouble first_result;
+    gint hits;
+
+} TuneStats;
+
+typedef struct
+{
+    /* Seconds a transfer takes, and the mean deviation of it */
+    gdouble mean;
+    gdouble dev;
+    gint transfers;
+
+} TransferStats;
+
+/////////////////////////////////
+
+static GMutex tune_lock;
+static TuneStats tune_stats[GLYR_GET_ANY + 1];
+
+/* "<type> <host>" -> TransferStats */
+static GHashTable * transfer_stats = NULL;
+
+/////////////////////////////////
+
+static gdouble moving_average (gdouble average, gdouble sample, gint samples)
+{
+    return (samples == 0) ? sample : average + AUTOTUNE_ALPHA * (sample - average);
+}
+
+/////////////////////////////////
+
+static gboolean type_is_valid (GLYR_GET_TYPE type)
+{
+    return (type > GLYR_GET_UNKNOWN && type <= GLYR_GET_ANY);
+}
+
+/////////////////////////////////
+
+void autotune_record_wave (GLYR_GET_TYPE type, gint started, gint succeeded, gdouble first_result)
+{
+    if (type_is_valid (type) && started > 0)
+    {
+        g_mutex_lock (&tune_lock);
+
+        TuneStats * stats = &tune_stats[type];
+        stats->success_rate = moving_average (stats->success_rate, (gdouble) succeeded / started, stats->waves);
+        stats->waves++;
+
+        if (first_result >= 0.0)
+        {
+            stats->first_result = moving_average (stats->first_result, first_result, stats->hits);
+            stats->hits++;
+        }
+
+        g_mutex_unlock (&tune_lock);
+    }
+}
+
+/////////////////////////////////
+
+/* Transfers are told apart by type and host, as every provider has a host of its own */
+static gchar * transfer_key (GLYR_GET_TYPE type, const gchar * url)
+{
+    const gchar * host = (url != NULL) ? strstr (url,"://") : NULL;
+    host = (host != NULL) ? host + 3 : (url != NULL) ? url : "";
+
+    gsize host_len = strcspn (host,"/?#");
+    return g_strdup_printf ("%d %.*s",type, (int) host_len,host);
+}
+
+/////////////////////////////////
+
+/* Needs tune_lock to be held */
+static TransferStats * transfer_stats_of (GLYR_GET_TYPE type, const gchar * url, gboolean create)
+{
+    if (transfer_stats == NULL)
+    {
+        if (create == FALSE)
+        {
+            return NULL;
+        }
+        transfer_stats = g_hash_table_new_full (g_str_hash,g_str_equal,g_free,g_free);
+    }
+
+    gchar * key = transfer_key (type,url);
+    TransferStats * stats = g_hash_table_lookup (transfer_stats,key);
+    if (stats == NULL && create == TRUE)
+    {
+        stats = g_malloc0 (sizeof (TransferStats) );
+        g_hash_table_insert (transfer_stats,key,stats);
+    }
+    else
+    {
+        g_free (key);
+    }
+    return stats;
+}
+
+/////////////////////////////////
+
+static void add_transfer_sample (GLYR_GET_TYPE type, const gchar * url, gdouble seconds)
+{
+    g_mutex_lock (&tune_lock);
+
+    TransferStats * stats = transfer_stats_of (type,url,TRUE);
+    gdouble deviation = ABS (seconds - stats->mean);
+    stats->dev  = moving_average (stats->dev, (stats->transfers) ? deviation : seconds / 2, stats->transfers);
+    stats->mean = moving_average (stats->mean, seconds, stats->transfers);
+    stats->transfers++;
+
+    g_mutex_unlock (&tune_lock);
+}
+
+/////////////////////////////////
+
+void autotune_record_transfer (GLYR_GET_TYPE type, const gchar * url, gdouble seconds)
+{
+    if (type_is_valid (type) && seconds >= 0.0)
+    {
+        add_transfer_sample (type,url,seconds);
+    }
+}
+
+/////////////////////////////////
+
+void autotune_record_timeout (GLYR_GET_TYPE type, const gchar * url, gdouble limit)
+{
+    /* It would have taken longer than limit, by how much is unknown.
+     * Guessing high lets the timeout grow again till transfers fit in.
+     */
+    if (type_is_valid (type) && limit > 0.0)
+    {
+        add_transfer_sample (type,url,limit * AUTOTUNE_TIMEOUT_PENALTY);
+    }
+}
+
+/////////////////////////////////
+
+gint autotune_parallel (GLYR_GET_TYPE type, gint fallback, gint max)
+{
+    gint parallel = fallback;
+    max = MAX (max,1);
+
+    if (type_is_valid (type) )
+    {
+        g_mutex_lock (&tune_lock);
+
+        TuneStats * stats = &tune_stats[type];
+        if (stats->waves >= AUTOTUNE_MIN_WAVES)
+        {
+            /* Smallest number of providers where at least one delivers with
+             * AUTOTUNE_WAVE_SUCCESS probability. More would only waste requests,
+             * less would cost another round trip.
+             */
+            gdouble miss = 1.0 - CLAMP (stats->success_rate,0.05,0.95);
+            gdouble all_missed = miss;
+
+            parallel = 1;
+            while (all_missed > 1.0 - AUTOTUNE_WAVE_SUCCESS && parallel < max)
+            {
+                all_missed *= miss;
+                parallel++;
+            }
+        }
+
+        g_mutex_unlock (&tune_lock);
+    }
+    return CLAMP (parallel,1,max);
+}
+
+/////////////////////////////////
+
+glong autotune_timeout (GLYR_GET_TYPE type, const gchar * url, glong fallback)
+{
+    glong timeout = fallback;
+    if (type_is_valid (type) )
+    {
+        g_mutex_lock (&tune_lock);
+
+        TuneStats * stats = &tune_stats[type];
+        TransferStats * transfers = transfer_stats_of (type,url,FALSE);
+        if (transfers != NULL && transfers->transfers >= AUTOTUNE_MIN_TRANSFERS)
+        {
+            /* Almost every transfer that succeeds at all is done by then,
+             * and leave room to get at least the first result of a wave */
+            gdouble expected = MAX (transfers->mean + 4 * transfers->dev, 2 * stats->first_result);
+            timeout = (glong) (expected + 1.0);
+        }
+
+        g_mutex_unlock (&tune_lock);
+    }
+    return CLAMP (timeout,MIN (AUTOTUNE_MIN_TIMEOUT,fallback),fallback);
+}
+
+/////////////////////////////////
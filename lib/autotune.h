@@ -0,0 +1,54 @@
+/***********************************************************
+ * This file is part of glyr
+ * + a commnadline tool and library to download various sort of music related metadata.
+ * + Copyright (C) [2011]  [Christopher Pahl]
+ * + Hosted at: https://github.com/sahib/glyr
+ *
+ * glyr is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * glyr is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with glyr. If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************/
+
+#ifndef GLYR_AUTOTUNE_H
+#define GLYR_AUTOTUNE_H
+
+#include "types.h"
+#include <glib.h>
+
+/* Weight of a new sample in the moving averages */
+#define AUTOTUNE_ALPHA 0.2
+
+/* Samples needed before the averages are trusted */
+#define AUTOTUNE_MIN_WAVES 3
+#define AUTOTUNE_MIN_TRANSFERS 5
+
+/* Wanted probability that at least one provider of a wave delivers */
+#define AUTOTUNE_WAVE_SUCCESS 0.9
+
+/* Tuned timeouts never go below this (seconds) */
+#define AUTOTUNE_MIN_TIMEOUT 3
+
+/* A timed out transfer counts as one that took this many times the timeout */
+#define AUTOTUNE_TIMEOUT_PENALTY 2.0
+
+/* Feed the controller, called by async_download(); transfers are learned per host of url */
+void autotune_record_wave (GLYR_GET_TYPE type, gint started, gint succeeded, gdouble first_result);
+void autotune_record_transfer (GLYR_GET_TYPE type, const gchar * url, gdouble seconds);
+void autotune_record_timeout (GLYR_GET_TYPE type, const gchar * url, gdouble limit);
+
+/* Number of providers to query at once, fallback if there's not enough data yet */
+gint autotune_parallel (GLYR_GET_TYPE type, gint fallback, gint max);
+
+/* Timeout in seconds for a transfer of url, never more than fallback */
+glong autotune_timeout (GLYR_GET_TYPE type, const gchar * url, glong fallback);
+
+#endif
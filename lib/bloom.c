@@ -0,0 +1,115 @@
+/***********************************************************
+ * This file is part of glyr
+ * + a commnadline tool and library to download various sort of music related metadata.
+ * + Copyright (C) [2011]  [Christopher Pahl]
+ * + Hosted at: https://github.com/sahib/glyr
+ *
+ * glyr is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * glyr is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with glyr. If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************/
+
+
+/* Bloom filter with double hashing: the probes are h1 + i * h2,
+ * both taken from one content_hash() of the key.
+ */
+
+#include "bloom.h"
+#include "hash.h"
+#include <string.h>
+
+struct _BloomFilter
+{
+    /* Number of bits - 1, the size is a power of two */
+    guint64 mask;
+    volatile guint * words;
+};
+
+/////////////////////////////////
+
+BloomFilter * bloom_new (gsize expected_keys)
+{
+    guint64 bits = 1024;
+    while (bits < (guint64) expected_keys * BLOOM_BITS_PER_KEY)
+    {
+        bits <<= 1;
+    }
+
+    BloomFilter * filter = g_malloc0 (sizeof (BloomFilter) );
+    filter->mask = bits - 1;
+    filter->words = g_malloc0 (bits / 8);
+    return filter;
+}
+
+/////////////////////////////////
+
+static void bloom_probes (const void * key, gsize size, guint64 * h1, guint64 * h2)
+{
+    guchar digest[CONTENT_HASH_SIZE];
+    content_hash (key,size,digest);
+    memcpy (h1,digest + 0,8);
+    memcpy (h2,digest + 8,8);
+
+    /* An even step would only ever visit half of the bits */
+    *h2 |= 1;
+}
+
+/////////////////////////////////
+
+void bloom_add (BloomFilter * filter, const void * key, gsize size)
+{
+    if (filter != NULL && key != NULL)
+    {
+        guint64 h1, h2;
+        bloom_probes (key,size,&h1,&h2);
+        for (gint i = 0; i < BLOOM_PROBES; i++, h1 += h2)
+        {
+            guint64 bit = h1 & filter->mask;
+            g_atomic_int_or (&filter->words[bit / 32],1u << (bit % 32) );
+        }
+    }
+}
+
+/////////////////////////////////
+
+gboolean bloom_maybe_contains (BloomFilter * filter, const void * key, gsize size)
+{
+    if (filter == NULL || key == NULL)
+    {
+        return TRUE;
+    }
+
+    guint64 h1, h2;
+    bloom_probes (key,size,&h1,&h2);
+    for (gint i = 0; i < BLOOM_PROBES; i++, h1 += h2)
+    {
+        guint64 bit = h1 & filter->mask;
+        if ( (g_atomic_int_get (&filter->words[bit / 32]) & (1u << (bit % 32) ) ) == 0)
+        {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/////////////////////////////////
+
+void bloom_free (BloomFilter * filter)
+{
+    if (filter != NULL)
+    {
+        g_free ( (gpointer) filter->words);
+        g_free (filter);
+    }
+}
+
+/////////////////////////////////
@@ -0,0 +1,43 @@
+/***********************************************************
+ * This file is part of glyr
+ * + a commnadline tool and library to download various sort of music related metadata.
+ * + Copyright (C) [2011]  [Christopher Pahl]
+ * + Hosted at: https://github.com/sahib/glyr
+ *
+ * glyr is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * glyr is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with glyr. If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************/
+
+
+#ifndef GLYR_BLOOM_H
+#define GLYR_BLOOM_H
+
+#include <glib.h>
+
+/* Bits per expected key; with BLOOM_PROBES probes ~1% false positives */
+#define BLOOM_BITS_PER_KEY 10
+#define BLOOM_PROBES 7
+
+/* Set of keys answering "definitely not in" or "maybe in".
+ * Keys cannot be removed, and adding more keys than expected only
+ * raises the rate of "maybe" answers. add and contains may be called from
+ * several threads at once.
+ */
+typedef struct _BloomFilter BloomFilter;
+
+BloomFilter * bloom_new (gsize expected_keys);
+void bloom_add (BloomFilter * filter, const void * key, gsize size);
+gboolean bloom_maybe_contains (BloomFilter * filter, const void * key, gsize size);
+void bloom_free (BloomFilter * filter);
+
+#endif
@@ -23,22 +23,31 @@
 #include "core.h"
 #include "glyr.h"
 #include "register_plugins.h"
+#include "prefetch.h"
+#include "bloom.h"
+#include "stringlib.h"
 
 ///////////////////////////////
 
 enum
 {
     SQL_TABLE_DEF,
+    SQL_UPGRADE_HASH,
+    SQL_UPGRADE_BLOB,
+    SQL_UPGRADE_KEYS,
+    SQL_UPGRADE_ACCESS,
+    SQL_INDEX_DEF,
+    SQL_TEMP_DEF,
     SQL_FOREACH,
-    SQL_DELETE_SELECT,
-    SQL_ACTUAL_DELETE,
-    SQL_LOOKUP,
-    SQL_INSERT_CACHE
+    SQL_DELETE,
+    SQL_LOOKUP
 };
 
 static const char * sqlcode[] =
 {
     [SQL_TABLE_DEF] =
+    "PRAGMA auto_vacuum = INCREMENTAL; -- Only has an effect on new databases    \n"
+    "PRAGMA journal_mode = WAL;                                                  \n"
     "PRAGMA synchronous = 1;                                                     \n"
     "PRAGMA temp_store = 2;                                                      \n"
     "BEGIN IMMEDIATE;                                                            \n"
@@ -46,9 +55,12 @@ static const char * sqlcode[] =
     "CREATE TABLE IF NOT EXISTS providers (provider_name VARCHAR(20) UNIQUE);    \n"
     "                                                                            \n"
     "-- Artist                                                                   \n"
-    "CREATE TABLE IF NOT EXISTS artists (artist_name VARCHAR(128) UNIQUE);       \n"
-    "CREATE TABLE IF NOT EXISTS albums  (album_name  VARCHAR(128) UNIQUE);       \n"
-    "CREATE TABLE IF NOT EXISTS titles  (title_name  VARCHAR(128) UNIQUE);       \n"
+    "CREATE TABLE IF NOT EXISTS artists (artist_name VARCHAR(128) UNIQUE,        \n"
+    "                                    artist_key  VARCHAR(128));              \n"
+    "CREATE TABLE IF NOT EXISTS albums  (album_name  VARCHAR(128) UNIQUE,        \n"
+    "                                    album_key   VARCHAR(128));              \n"
+    "CREATE TABLE IF NOT EXISTS titles  (title_name  VARCHAR(128) UNIQUE,        \n"
+    "                                    title_key   VARCHAR(128));              \n"
     "                                                                            \n"
     "-- Enum                                                                     \n"
     "CREATE TABLE IF NOT EXISTS image_types(image_type_name VARCHAR(16) UNIQUE); \n"
@@ -70,7 +82,10 @@ static const char * sqlcode[] =
     "                     data_checksum BLOB,                                    \n"
     "                     data BLOB,                                             \n"
     "                     rating INTEGER,                                        \n"
-    "                     timestamp FLOAT                                        \n"
+    "                     timestamp FLOAT,                                       \n"
+    "                     source_hash INTEGER,                                   \n"
+    "                     data_file VARCHAR(40),                                 \n"
+    "                     last_access FLOAT                                      \n"
     ");                                                                          \n"
     "CREATE INDEX IF NOT EXISTS index_artist_id   ON metadata(artist_id);        \n"
     "CREATE INDEX IF NOT EXISTS index_album_id    ON metadata(album_id);         \n"
@@ -78,6 +93,13 @@ static const char * sqlcode[] =
     "CREATE INDEX IF NOT EXISTS index_provider_id ON metadata(provider_id);      \n"
     "CREATE UNIQUE INDEX IF NOT EXISTS index_unique                              \n"
     "       ON metadata(get_type,data_type,data_checksum,source_url);            \n"
+    "                                                                            \n"
+    "-- Providers that had nothing for a query, see db_miss_lookup()             \n"
+    "CREATE TABLE IF NOT EXISTS misses(get_type INTEGER,                         \n"
+    "                                  lookup_key TEXT,                          \n"
+    "                                  provider_name VARCHAR(20),                \n"
+    "                                  timestamp FLOAT,                          \n"
+    "       UNIQUE(get_type,lookup_key,provider_name));                          \n"
     "-- Insert imageformats                                                      \n"
     "INSERT OR IGNORE INTO image_types VALUES('jpeg');                           \n"
     "INSERT OR IGNORE INTO image_types VALUES('jpg');                            \n"
@@ -86,6 +108,55 @@ static const char * sqlcode[] =
     "INSERT OR IGNORE INTO image_types VALUES('tiff');                           \n"
     "INSERT OR IGNORE INTO db_version VALUES(2);                                 \n"
     "COMMIT;                                                                     \n",
+    [SQL_UPGRADE_HASH] =
+    "BEGIN IMMEDIATE;                                                            \n"
+    "ALTER TABLE metadata ADD COLUMN source_hash INTEGER;                        \n"
+    "UPDATE metadata SET source_hash = glyr_url_hash(source_url)                 \n"
+    "       WHERE source_url IS NOT NULL;                                        \n"
+    "COMMIT;                                                                     \n",
+    [SQL_UPGRADE_BLOB] =
+    "ALTER TABLE metadata ADD COLUMN data_file VARCHAR(40);                      \n",
+    [SQL_UPGRADE_KEYS] =
+    "BEGIN IMMEDIATE;                                                            \n"
+    "ALTER TABLE artists ADD COLUMN artist_key VARCHAR(128);                     \n"
+    "ALTER TABLE albums  ADD COLUMN album_key  VARCHAR(128);                     \n"
+    "ALTER TABLE titles  ADD COLUMN title_key  VARCHAR(128);                     \n"
+    "UPDATE artists SET artist_key = glyr_lookup_key(artist_name);               \n"
+    "UPDATE albums  SET album_key  = glyr_lookup_key(album_name);                \n"
+    "UPDATE titles  SET title_key  = glyr_lookup_key(title_name);                \n"
+    "COMMIT;                                                                     \n",
+    [SQL_UPGRADE_ACCESS] =
+    "BEGIN IMMEDIATE;                                                            \n"
+    "ALTER TABLE metadata ADD COLUMN last_access FLOAT;                          \n"
+    "UPDATE metadata SET last_access = timestamp;                                \n"
+    "COMMIT;                                                                     \n",
+    [SQL_INDEX_DEF] =
+    "BEGIN IMMEDIATE;                                                            \n"
+    "CREATE INDEX IF NOT EXISTS index_source_hash ON metadata(source_hash);      \n"
+    "CREATE INDEX IF NOT EXISTS index_checksum                                   \n"
+    "       ON metadata(data_type,data_size,data_checksum);                      \n"
+    "CREATE INDEX IF NOT EXISTS index_data_file ON metadata(data_file);          \n"
+    "CREATE INDEX IF NOT EXISTS index_artist_key ON artists(artist_key);         \n"
+    "CREATE INDEX IF NOT EXISTS index_album_key  ON albums(album_key);           \n"
+    "CREATE INDEX IF NOT EXISTS index_title_key  ON titles(title_key);           \n"
+    "CREATE INDEX IF NOT EXISTS index_last_access ON metadata(last_access);      \n"
+    "CREATE INDEX IF NOT EXISTS index_age ON metadata(get_type,timestamp);       \n"
+    "CREATE INDEX IF NOT EXISTS index_miss_age ON misses(timestamp);             \n"
+    "INSERT OR IGNORE INTO db_version VALUES(3);                                 \n"
+    "INSERT OR IGNORE INTO db_version VALUES(4);                                 \n"
+    "INSERT OR IGNORE INTO db_version VALUES(5);                                 \n"
+    "INSERT OR IGNORE INTO db_version VALUES(6);                                 \n"
+    "INSERT OR IGNORE INTO db_version VALUES(7);                                 \n"
+    "COMMIT;                                                                     \n",
+    /* Per connection - remembers the blobs of deleted rows, see db_blob_release_deleted() */
+    [SQL_TEMP_DEF] =
+    "CREATE TEMP TABLE IF NOT EXISTS released_blobs(data_file VARCHAR(40),       \n"
+    "                                               data_size INTEGER);          \n"
+    "CREATE TEMP TRIGGER IF NOT EXISTS release_blob AFTER DELETE ON main.metadata\n"
+    "       WHEN old.data_file IS NOT NULL                                       \n"
+    "BEGIN                                                                       \n"
+    "       INSERT INTO released_blobs VALUES(old.data_file,old.data_size);      \n"
+    "END;                                                                        \n",
     [SQL_FOREACH] =
     "SELECT artist_name,                                      \n"
     "        album_name,                                      \n"
@@ -101,39 +172,29 @@ static const char * sqlcode[] =
     "        data_checksum,                                   \n"
     "        data,                                            \n"
     "        rating,                                          \n"
-    "        timestamp                                        \n"
+    "        timestamp,                                       \n"
+    "        data_file                                        \n"
     "FROM metadata as m                                       \n"
     "LEFT JOIN artists     AS a ON m.artist_id     = a.rowid  \n"
     "LEFT JOIN albums      AS b ON m.album_id      = b.rowid  \n"
     "LEFT JOIN titles      AS t ON m.title_id      = t.rowid  \n"
     "LEFT JOIN image_types AS i ON m.image_type_id = i.rowid  \n"
     "JOIN providers AS p on m.provider_id          = p.rowid  \n",
-    [SQL_DELETE_SELECT] =
-    "SELECT get_type,                                     \n"
-    "       artist_id,                                    \n"
-    "       album_id,                                     \n"
-    "       title_id,                                     \n"
-    "       provider_id                                   \n"
-    "       FROM metadata AS m                            \n"
+    [SQL_DELETE] =
+    "DELETE FROM metadata WHERE rowid IN (                \n"
+    "SELECT m.rowid FROM metadata AS m                    \n"
     "LEFT JOIN artists    AS a ON a.rowid = m.artist_id   \n"
     "LEFT JOIN albums     AS b ON b.rowid = m.album_id    \n"
     "LEFT JOIN titles     AS t ON t.rowid = m.title_id    \n"
     "INNER JOIN providers AS p ON p.rowid = m.provider_id \n"
     "WHERE                                                \n"
-    "       m.get_type  = %d                              \n"
+    "     %sm.get_type  = :type                           \n"
     "   %s  -- Title  Contraint                           \n"
     "   %s  -- Album  Constraint                          \n"
     "   %s  -- Artist Constraint                          \n"
-    "   AND p.provider_name IN(%s)                        \n"
+    "   AND instr(:providers,','||p.provider_name||',')   \n"
     "   %s  -- 'IsALink' Constraint                       \n"
-    "LIMIT %d;                                            \n",
-    [SQL_ACTUAL_DELETE] =
-    "DELETE FROM metadata WHERE \n"
-    "get_type    %s %s AND      \n"
-    "artist_id   %s %s AND      \n"
-    "album_id    %s %s AND      \n"
-    "title_id    %s %s AND      \n"
-    "provider_id %s %s;         \n",
+    "LIMIT :limit);                                       \n",
     [SQL_LOOKUP] =
     "SELECT artist_name,                                      \n"
     "        album_name,                                      \n"
@@ -149,68 +210,222 @@ static const char * sqlcode[] =
     "        data_checksum,                                   \n"
     "        data,                                            \n"
     "        rating,                                          \n"
-    "        timestamp                                        \n"
+    "        timestamp,                                       \n"
+    "        data_file,                                       \n"
+    "        m.rowid                                          \n"
     "FROM metadata as m                                       \n"
     "LEFT JOIN artists AS a ON m.artist_id  = a.rowid         \n"
     "LEFT JOIN albums  AS b ON m.album_id   = b.rowid         \n"
     "LEFT JOIN titles  AS t ON m.title_id   = t.rowid         \n"
     "JOIN providers as p on m.provider_id   = p.rowid         \n"
     "LEFT JOIN image_types as i on m.image_type_id = i.rowid  \n"
-    "WHERE m.get_type = %d                                    \n"
+    "WHERE %sm.get_type = :type                               \n"
     "                   %s  -- Title constr.                  \n"
     "                   %s  -- Album constr.                  \n"
     "                   %s  -- Artist constr.                 \n"
     "                   %s                                    \n"
-    "           AND provider_name IN(%s)                      \n"
-    "LIMIT %d;                                                \n",
-    [SQL_INSERT_CACHE] =
+    "           AND instr(:providers,','||provider_name||',') \n"
+    "ORDER BY rating DESC, timestamp DESC                     \n"
+    "LIMIT :limit;                                            \n"
+};
+
+/* Precompiled in glyr_db_init(), see DBStatement */
+static const char * stmtcode[] =
+{
+    [DB_STMT_BEGIN]  = "BEGIN IMMEDIATE;",
+    [DB_STMT_COMMIT] = "COMMIT;",
+    [DB_STMT_ROLLBACK] = "ROLLBACK;",
+    [DB_STMT_INSERT_ARTIST]   = "INSERT OR IGNORE INTO artists   VALUES(?,?);",
+    [DB_STMT_INSERT_ALBUM]    = "INSERT OR IGNORE INTO albums    VALUES(?,?);",
+    [DB_STMT_INSERT_TITLE]    = "INSERT OR IGNORE INTO titles    VALUES(?,?);",
+    [DB_STMT_INSERT_PROVIDER] = "INSERT OR IGNORE INTO providers VALUES(?);",
+    [DB_STMT_INSERT_CACHE] =
     "INSERT OR IGNORE INTO metadata VALUES(                                \n"
-    "  (SELECT rowid FROM artists   WHERE artist_name   = LOWER('%q')),    \n"
-    "  (SELECT rowid FROM albums    WHERE album_name    = LOWER('%q')),    \n"
-    "  (SELECT rowid FROM titles    WHERE title_name    = LOWER('%q')),    \n"
-    "  (SELECT rowid FROM providers WHERE provider_name = LOWER('%q')),    \n"
+    "  (SELECT rowid FROM artists   WHERE artist_name   = LOWER(?)),       \n"
+    "  (SELECT rowid FROM albums    WHERE album_name    = LOWER(?)),       \n"
+    "  (SELECT rowid FROM titles    WHERE title_name    = LOWER(?)),       \n"
+    "  (SELECT rowid FROM providers WHERE provider_name = LOWER(?)),       \n"
     "  ?,                                                                  \n"
-    "  (SELECT rowid FROM image_types WHERE image_type_name = LOWER('%q')),\n"
-    "  ?,?,?,?,?,?,?,?,?                                                   \n"
-    ");                                                                    \n"
+    "  (SELECT rowid FROM image_types WHERE image_type_name = LOWER(?)),   \n"
+    "  ?,?,?,?,?,?,?,?,?,?,?,?                                             \n"
+    ");                                                                    \n",
+    [DB_STMT_DELETE_CHECKSUM] =
+    "DELETE FROM metadata WHERE data_checksum = ? ;\n",
+    [DB_STMT_BLOB_USED] =
+    "SELECT EXISTS(SELECT 1 FROM metadata WHERE data_file = ?);\n",
+    /* Keys starting like ?1, for the fuzzy fallback of glyr_db_lookup() */
+    [DB_STMT_NEAR_ARTIST] =
+    "SELECT DISTINCT artist_key FROM artists WHERE artist_key >= ?1 AND artist_key < ?2 LIMIT 256;\n",
+    [DB_STMT_NEAR_ALBUM] =
+    "SELECT DISTINCT album_key  FROM albums  WHERE album_key  >= ?1 AND album_key  < ?2 LIMIT 256;\n",
+    [DB_STMT_NEAR_TITLE] =
+    "SELECT DISTINCT title_key  FROM titles  WHERE title_key  >= ?1 AND title_key  < ?2 LIMIT 256;\n",
+    [DB_STMT_RELEASED_BLOBS] =
+    "SELECT DISTINCT data_file FROM released_blobs;\n",
+    [DB_STMT_FORGET_RELEASED] =
+    "DELETE FROM released_blobs;\n",
+    /* Maintenance, see glyr_db_maintain() */
+    [DB_STMT_TOUCH] =
+    "UPDATE metadata SET last_access = ?2 WHERE rowid = ?1 AND last_access < ?2;\n",
+    [DB_STMT_EXPIRE] =
+    "DELETE FROM metadata WHERE rowid IN (                                     \n"
+    "       SELECT rowid FROM metadata WHERE get_type = ?1 AND timestamp < ?2  \n"
+    "       LIMIT ?3);                                                         \n",
+    [DB_STMT_EVICT] =
+    "DELETE FROM metadata WHERE rowid IN (                                     \n"
+    "       SELECT rowid FROM metadata ORDER BY last_access LIMIT ?1);         \n",
+    [DB_STMT_BLOB_BYTES] =
+    "SELECT total(data_size) FROM (SELECT data_size FROM metadata              \n"
+    "       WHERE data_file IS NOT NULL GROUP BY data_file);                   \n",
+    /* Like DB_STMT_BLOB_BYTES, for the blobs of deleted rows no other row uses */
+    [DB_STMT_RELEASED_BYTES] =
+    "SELECT total(data_size) FROM (SELECT data_size FROM released_blobs AS r   \n"
+    "       WHERE NOT EXISTS(SELECT 1 FROM metadata                            \n"
+    "                        WHERE data_file = r.data_file)                    \n"
+    "       GROUP BY data_file);                                               \n",
+    [DB_STMT_PAGE_SIZE]      = "PRAGMA page_size;",
+    [DB_STMT_PAGE_COUNT]     = "PRAGMA page_count;",
+    [DB_STMT_FREELIST_COUNT] = "PRAGMA freelist_count;",
+    [DB_STMT_VACUUM] = "PRAGMA incremental_vacuum(64); -- DB_MAINTAIN_SLICE",
+    [DB_STMT_EXPIRE_MISSES] =
+    "DELETE FROM misses WHERE rowid IN (                                       \n"
+    "       SELECT rowid FROM misses WHERE timestamp < ?1 LIMIT ?2);           \n",
+    /* Negative caching, see db_miss_lookup() */
+    [DB_STMT_RECENT_MISSES] =
+    "SELECT provider_name FROM misses WHERE get_type = ?1 AND lookup_key = ?2 AND timestamp >= ?3;\n",
+    [DB_STMT_INSERT_MISS] =
+    "INSERT OR REPLACE INTO misses VALUES(?1,?2,?3,?4);\n",
+    [DB_STMT_FORGET_MISS] =
+    "DELETE FROM misses WHERE get_type = ?1 AND lookup_key = ?2 AND provider_name = ?3;\n",
+    [DB_STMT_CONTAINS] =
+    "SELECT EXISTS(SELECT 1 FROM metadata                                      \n"
+    "              WHERE data_type = ?1 AND data_size = ?2 AND data_checksum = ?3) \n"
+    "    OR EXISTS(SELECT 1 FROM metadata                                          \n"
+    "              WHERE source_hash = ?4 AND source_url = ?5 AND data_type = ?1); \n"
+};
+
+/* SQL_LOOKUP and SQL_DELETE depend on which constraints a query has,
+ * every combination ("shape") gets compiled once, when it's needed first.
+ */
+#define SHAPE_TITLE      (1 << 0)
+#define SHAPE_ALBUM      (1 << 1)
+#define SHAPE_ARTIST     (1 << 2)
+#define SHAPE_LINKS_ONLY (1 << 3)
+#define SHAPE_NO_LINKS   (2 << 3)
+#define SHAPE_COUNT      (3 << 3)
+
+struct _GlyrDBStatements
+{
+    /* A statement has state of its own, so only one thread may use it at a time */
+    GRecMutex lock;
+
+    sqlite3_stmt * fixed[DB_STMT_LAST];
+    sqlite3_stmt * delete_shaped[SHAPE_COUNT];
+
+    /* Nesting of glyr_db_batch_begin(), only the outermost one opens a transaction */
+    gint batch_depth;
+    gpointer batch_owner;
+};
+
+/* A connection that only reads, owned by one thread at a time */
+struct _DBReader
+{
+    sqlite3 * handle;
+
+    /* Compiled on first use */
+    sqlite3_stmt * fixed[DB_STMT_LAST];
+    sqlite3_stmt * lookup[SHAPE_COUNT];
+};
+
+/* Limits of glyr_db_maintain(), and the accesses it has to write down */
+struct _GlyrDBPolicy
+{
+    GMutex lock;
+
+    /* Max. age per GLYR_GET_TYPE in seconds, 0 for no limit */
+    gdouble ttl[GLYR_GET_ANY];
+    gint64 max_size;
+
+    /* Max. edits of the fuzzy fallback of glyr_db_lookup(), 0 (default) for exact keys only */
+    guint lookup_fuzz;
+
+    /* How long a provider that had nothing is not asked again, 0 (default) to always ask */
+    gdouble miss_ttl;
+
+    /* Lookups don't write; they note (rowid,time) here */
+    GArray * accessed;
+};
+
+typedef struct
+{
+    gint64 rowid;
+    gdouble time;
+
+} DBAccess;
+
+/* Accesses beyond this many are dropped till the next glyr_db_maintain() */
+#define DB_ACCESS_LOG_MAX 16384
+
+/* Rows deleted / pages freed per transaction of glyr_db_maintain() */
+#define DB_MAINTAIN_SLICE 64
+
+struct _GlyrDBReaders
+{
+    gchar * path;
+
+    /* Readers not in use right now */
+    GAsyncQueue * idle;
+
+    /* All opened readers, at most max_opened */
+    GMutex lock;
+    GList * opened;
+    guint max_opened;
+
+    /* Reads on the writing connection, while holding the statement lock */
+    DBReader writer;
 };
 
 ////////////////////////////////////////////////////////
 ////////////////////// Prototypes //////////////////////
 ////////////////////////////////////////////////////////
 
-static void insert_cache_data (GlyrDatabase * db, GlyrQuery * query, GlyrMemCache * cache);
+static gboolean insert_cache_data (GlyrDatabase * db, GlyrQuery * query, GlyrMemCache * cache);
+static gboolean insert_query_names (GlyrDatabase * db, GlyrQuery * q);
+static void insert_name (GlyrDatabase * db, DBStatement id, const gchar * name);
 static void execute (GlyrDatabase * db, const gchar * sql_statement);
-static gchar * convert_from_option_to_sql (GlyrQuery * q);
+static gboolean execute_statement (GlyrDatabase * db, DBStatement id);
+static gchar * convert_from_option_to_list (GlyrQuery * q);
+
+static void upgrade_schema (GlyrDatabase * db);
+static void load_known_items (GlyrDatabase * db);
+
+static void setup_connection (sqlite3 * db_handle);
+static struct _GlyrDBStatements * statements_new (sqlite3 * db_handle);
+static void statements_free (struct _GlyrDBStatements * statements);
+static struct _GlyrDBReaders * readers_new (const gchar * path, sqlite3 * writer);
+static void readers_free (struct _GlyrDBReaders * readers);
+static sqlite3_stmt * delete_acquire (GlyrDatabase * db, GlyrQuery * query);
+static sqlite3_stmt * reader_lookup_statement (DBReader * reader, GlyrQuery * query);
+static void bind_query (sqlite3_stmt * stmt, GlyrQuery * query);
+static GlyrMemCache * step_lookup (GlyrDatabase * db, sqlite3_stmt * stmt);
+static GlyrMemCache * fuzzy_lookup (GlyrDatabase * db, DBReader * reader, sqlite3_stmt * stmt, GlyrQuery * query);
 
 static double get_current_time (void);
-static void add_to_cache_list (GlyrMemCache ** list, GlyrMemCache * to_add);
 
-static int delete_callback (void * result, int argc, char ** argv, char ** azColName);
-static int select_callback (void * result, int argc, char ** argv, char ** azColName);
+static void note_access (GlyrDatabase * db, gint64 rowid, gdouble now);
+static void flush_accesses (GlyrDatabase * db);
+static gint64 single_value (GlyrDatabase * db, DBStatement id);
+static gint64 db_file_size (GlyrDatabase * db);
+static gint maintain_slice (GlyrDatabase * db, DBStatement id, gint type, gdouble before, gint64 * blob_bytes);
+
+/* NULL if the data of the row is lost */
+static GlyrMemCache * cache_from_row (GlyrDatabase * db, sqlite3_stmt * stmt);
 
 
 ////////////////////////////////////////////////////////
 ////////////////// Useful Defines //////////////////////
 ////////////////////////////////////////////////////////
 
-#define INSERT_STRING(SQL,ARG) {                        \
-        if(SQL && ARG) {                                    \
-            /* We have to use _ascii_ here,                   */\
-            /* since there seems to be some encoding problems */\
-            /* in SQLite, which are triggered by comparing    */\
-            /* lower and highercase umlauts for example       */\
-            /* Simple encoding-indepent lowercase prevents it */\
-            gchar * lower_str = g_ascii_strdown(ARG,-1);    \
-            gchar * sql = sqlite3_mprintf(SQL,lower_str);   \
-            execute(db,sql);                                \
-            sqlite3_free(sql);                              \
-            g_free(lower_str);                              \
-        }                                                   \
-    }
-
-////////////////////////////////////////////////////////
-
 /* Ensure no invalid data comes in */
 #define ABORT_ON_FAILED_REQS(REQS,OPT_ARG,ARG) {                   \
         if((REQS & OPT_ARG) == 0 && ARG == NULL) {                     \
@@ -221,24 +436,6 @@ static int select_callback (void * result, int argc, char ** argv, char ** azCol
 
 ////////////////////////////////////////////////////////
 
-#define ADD_CONSTRAINT(TO_CONSTR, FIELDNAME, VARNAME)                    \
-    {                                                                        \
-        /* We have to use _ascii_ here,                   */                 \
-        /* since there seems to be some encoding problems */                 \
-        /* in SQLite, which are triggered by comparing    */                 \
-        /* lower and highercase umlauts for example       */                 \
-        /* Simple encoding-indepent lowercase prevents it */                 \
-        \
-        gchar * lower = g_ascii_strdown(VARNAME,-1);                         \
-        if(lower != NULL)                                                    \
-        {                                                                    \
-            TO_CONSTR = sqlite3_mprintf("AND %s = '%q'\n",FIELDNAME,lower);  \
-            g_free(lower);                                                   \
-        }                                                                    \
-    }
-
-////////////////////////////////////////////////////////
-
 #define CACHE_GET_PROVIDER(cache) (((cache)&&(cache->prov)) ? ((cache)->prov) : "none")
 
 ////////////////////////////////////////////////////////
@@ -258,40 +455,20 @@ static int select_callback (void * result, int argc, char ** argv, char ** azCol
 /* How long to wait till returning SQLITE_BUSY */
 #define DB_BUSY_WAIT 5000
 
+/* Bytes of the db file every connection reads via mmap() */
+#define DB_MMAP_SIZE (256 * 1024 * 1024)
+
 #define DO_PROFILE false
 
 #if DO_PROFILE
-static GTimer * select_callback_timer = NULL;
-static float select_callback_spent = 0;
+static GTimer * row_timer = NULL;
+static float row_spent = 0;
 #endif
 
 ////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////
 
-typedef struct
-{
-    GlyrDatabase * con;
-    gint deleted;
-    gint max_delete;
-
-} delete_callback_data;
-
-
-typedef struct
-{
-    GlyrMemCache ** result;
-    GlyrQuery * query;
-    gint counter;
-    glyr_foreach_callback cb;
-    void * userptr;
-
-} select_callback_data;
-
-////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////
-
 __attribute__ ( (visibility ("default") ) )
 GlyrDatabase * glyr_db_init (const char * root_path)
 {
@@ -299,7 +476,7 @@ GlyrDatabase * glyr_db_init (const char * root_path)
 
 #if DO_PROFILE
     GTimer * open_db = g_timer_new();
-    select_callback_timer = g_timer_new();
+    row_timer = g_timer_new();
 #endif
 
     if (sqlite3_threadsafe() == FALSE)
@@ -327,10 +504,18 @@ GlyrDatabase * glyr_db_init (const char * root_path)
                 to_return = g_malloc0 (sizeof (GlyrDatabase) );
                 to_return->root_path = g_strdup (root_path);
                 to_return->db_handle = db_connection;
-                sqlite3_busy_timeout (db_connection,DB_BUSY_WAIT);
+                setup_connection (db_connection);
 
                 /* Now create the Tables via sql */
                 execute (to_return, (char*) sqlcode[SQL_TABLE_DEF]);
+                upgrade_schema (to_return);
+                execute (to_return,sqlcode[SQL_TEMP_DEF]);
+                to_return->statements = statements_new (db_connection);
+                to_return->readers = readers_new (db_file_path,db_connection);
+                to_return->policy = g_malloc0 (sizeof (struct _GlyrDBPolicy) );
+                to_return->policy->accessed = g_array_new (FALSE,FALSE,sizeof (DBAccess) );
+                g_mutex_init (&to_return->policy->lock);
+                load_known_items (to_return);
             }
             else
             {
@@ -366,6 +551,24 @@ void glyr_db_destroy (GlyrDatabase * db_object)
 {
     if (db_object != NULL)
     {
+        /* Background jobs might still write to it */
+        prefetch_drain (db_object);
+
+        /* Keep what was used lately */
+        flush_accesses (db_object);
+        g_array_free (db_object->policy->accessed,TRUE);
+        g_mutex_clear (&db_object->policy->lock);
+        g_free (db_object->policy);
+        db_object->policy = NULL;
+
+        /* Unfinalized statements keep the connection open */
+        readers_free (db_object->readers);
+        db_object->readers = NULL;
+        statements_free (db_object->statements);
+        db_object->statements = NULL;
+        bloom_free (db_object->known_items);
+        db_object->known_items = NULL;
+
         int db_err = sqlite3_close (db_object->db_handle);
         if (db_err == SQLITE_OK)
         {
@@ -389,14 +592,14 @@ int glyr_db_edit (GlyrDatabase * db, GlyrQuery * query, GlyrMemCache * edited)
     int result = 0;
     if (db && query)
     {
+        /* Others never see the old items gone and the new ones missing */
+        glyr_db_batch_begin (db);
         result = glyr_db_delete (db,query);
         if (result != 0)
         {
-            for (GlyrMemCache * elem = edited; elem; elem = elem->next)
-            {
-                glyr_db_insert (db,query,edited);
-            }
+            glyr_db_insert_batch (db,query,edited);
         }
+        glyr_db_batch_end (db);
     }
     return result;
 }
@@ -410,22 +613,23 @@ void glyr_db_replace (GlyrDatabase * db, unsigned char * md5sum, GlyrQuery * que
 {
     if (db != NULL && md5sum != NULL)
     {
-        gchar * sql = "DELETE FROM metadata WHERE data_checksum = ? ;\n";
-        sqlite3_stmt *stmt = NULL;
-        sqlite3_prepare_v2 (db->db_handle, sql, strlen (sql) + 1, &stmt, NULL);
+        glyr_db_batch_begin (db);
+
+        sqlite3_stmt * stmt = db_statement_acquire (db,DB_STMT_DELETE_CHECKSUM);
         sqlite3_bind_blob (stmt, 1, md5sum, 16, SQLITE_STATIC);
 
         if (sqlite3_step (stmt) != SQLITE_DONE)
         {
             glyr_message (1,query,"Error message: %s\n", sqlite3_errmsg (db->db_handle) );
         }
-
-        sqlite3_finalize (stmt);
+        db_statement_release (db,stmt);
 
         if (data != NULL)
         {
             glyr_db_insert (db,query,data);
         }
+
+        glyr_db_batch_end (db);
     }
 }
 
@@ -440,92 +644,108 @@ gint glyr_db_delete (GlyrDatabase * db, GlyrQuery * query)
     gint result = 0;
     if (db && query)
     {
-        /* Find out which fields are required for this getter */
-        GLYR_FIELD_REQUIREMENT reqs = glyr_get_requirements (query->type);
-
-        /* Spaces in SQL statements just for pretty debug printing */
-        gchar * artist_constr = "";
-        if ( (reqs & GLYR_REQUIRES_ARTIST) != 0 && query->artist)
-        {
-            ADD_CONSTRAINT (artist_constr,"a.artist_name",query->artist);
-        }
-
-        gchar * album_constr  = "";
-        if ( (reqs & GLYR_REQUIRES_ALBUM ) != 0 && query->album)
-        {
-            ADD_CONSTRAINT (album_constr,"b.album_name",query->album);
-        }
-
-        gchar * title_constr = "";
-        if ( (reqs & GLYR_REQUIRES_TITLE ) != 0 && query->title)
-        {
-            ADD_CONSTRAINT (title_constr,"t.title_name",query->title);
-        }
+        /* One statement and one transaction, however many rows go */
+        glyr_db_batch_begin (db);
 
-        /* Get a SQL formatted list of enabled providers: IN('lastfm','...') */
-        gchar * from_argument_list = convert_from_option_to_sql (query);
-
-        /* Check if links should be deleted */
-        gchar * img_url_constr = "";
-        if (TYPE_IS_IMAGE (query->type) )
+        sqlite3_stmt * delete = delete_acquire (db,query);
+        if (delete != NULL)
         {
-            if (query->download == FALSE)
+            bind_query (delete,query);
+            if (sqlite3_step (delete) == SQLITE_DONE)
             {
-                img_url_constr = sqlite3_mprintf ("AND data_type = %d ", GLYR_TYPE_IMG_URL);
+                result = sqlite3_changes (db->db_handle);
             }
             else
             {
-                img_url_constr = sqlite3_mprintf ("AND NOT data_type = %d ", GLYR_TYPE_IMG_URL);
+                glyr_message (-1,NULL,"SQL Delete error: %s\n",sqlite3_errmsg (db->db_handle) );
             }
         }
+        db_statement_release (db,delete);
+
+        glyr_db_batch_end (db);
+    }
+    return result;
+}
 
-        gchar * sql = sqlite3_mprintf (sqlcode[SQL_DELETE_SELECT],
-                                       query->type,        /* Limit to <type>             */
-                                       title_constr,       /* Title Constr, may be empty  */
-                                       album_constr,       /* Album Constr, may be empty  */
-                                       artist_constr,      /* Artist Constr, may be empty */
-                                       from_argument_list, /* Provider contraint          */
-                                       img_url_constr,     /* Search for links?           */
-                                       query->number       /* LIMIT to <number>           */
-                                      );
+////////////////////////////////////
+////////////////////////////////////
+////////////////////////////////////
 
 
-        if (sql != NULL)
+__attribute__ ( (visibility ("default") ) )
+void glyr_db_foreach (GlyrDatabase * db, glyr_foreach_callback cb, void * userptr)
+{
+    if (db != NULL && cb != NULL)
+    {
+        /* Not one of the kept statements, cb may use db in turn */
+        sqlite3_stmt * stmt = NULL;
+        int rc = sqlite3_prepare_v2 (db->db_handle,sqlcode[SQL_FOREACH],-1,&stmt,NULL);
+        if (rc == SQLITE_OK)
         {
-            delete_callback_data cb_data;
-            cb_data.con = db;
-            cb_data.deleted = 0;
-            cb_data.max_delete = query->number;
-
-            gchar * err_msg = NULL;
-            sqlite3_exec (db->db_handle,sql,delete_callback,&cb_data,&err_msg);
-            if (err_msg != NULL)
+            while ( (rc = sqlite3_step (stmt) ) == SQLITE_ROW)
             {
-                glyr_message (-1,NULL,"SQL Delete error: %s\n",err_msg);
-                sqlite3_free (err_msg);
-            }
-            sqlite3_free (sql);
-            result = cb_data.deleted;
-        }
+                GlyrMemCache * cache = cache_from_row (db,stmt);
+                if (cache == NULL)
+                {
+                    continue;
+                }
 
-        /**
-         * Free ressources with according free calls,
-         */
+                GlyrQuery q;
+                glyr_query_init (&q);
+                glyr_opt_type (&q,sqlite3_column_int (stmt,7) );
+                glyr_opt_artist (&q, (const char *) sqlite3_column_text (stmt,0) );
+                glyr_opt_album (&q, (const char *) sqlite3_column_text (stmt,1) );
+                glyr_opt_title (&q, (const char *) sqlite3_column_text (stmt,2) );
+
+                int stop = cb (&q,cache,userptr);
+
+                glyr_query_destroy (&q);
+                DL_free (cache);
 
-        if (*artist_constr)
-            sqlite3_free (artist_constr);
+                if (stop != 0)
+                {
+                    rc = SQLITE_DONE;
+                    break;
+                }
+            }
+        }
 
-        if (*album_constr)
-            sqlite3_free (album_constr);
+        if (rc != SQLITE_DONE)
+        {
+            glyr_message (-1,NULL,"SQL Foreach error: %s\n",sqlite3_errmsg (db->db_handle) );
+        }
+        sqlite3_finalize (stmt);
+    }
+}
 
-        if (*title_constr)
-            sqlite3_free (title_constr);
+////////////////////////////////////
+////////////////////////////////////
+////////////////////////////////////
 
-        if (*img_url_constr)
-            sqlite3_free (img_url_constr);
+__attribute__ ( (visibility ("default") ) )
+GlyrMemCache * glyr_db_lookup (GlyrDatabase * db, GlyrQuery * query)
+{
+    GlyrMemCache * result = NULL;
+    if (db != NULL && query != NULL)
+    {
+        DBReader * reader = db_reader_acquire (db);
+        sqlite3_stmt * stmt = reader_lookup_statement (reader,query);
+        if (stmt != NULL)
+        {
+            bind_query (stmt,query);
+            result = step_lookup (db,stmt);
 
-        g_free (from_argument_list);
+            if (result == NULL)
+            {
+                result = fuzzy_lookup (db,reader,stmt,query);
+            }
+        }
+        db_reader_release (db,reader,stmt);
 
+#if DO_PROFILE
+        g_message ("Spent %.5f Seconds converting rows.\n",row_spent);
+        row_spent = 0;
+#endif
     }
     return result;
 }
@@ -536,31 +756,53 @@ gint glyr_db_delete (GlyrDatabase * db, GlyrQuery * query)
 
 
 __attribute__ ( (visibility ("default") ) )
-void glyr_db_foreach (GlyrDatabase * db, glyr_foreach_callback cb, void * userptr)
+void glyr_db_insert (GlyrDatabase * db, GlyrQuery * q, GlyrMemCache * cache)
 {
-    if (db != NULL && cb != NULL)
+    if (db && q && cache)
     {
-        select_callback_data scb_data;
-        scb_data.cb = cb;
-        scb_data.userptr = userptr;
+        glyr_db_batch_begin (db);
+        if (insert_query_names (db,q) == TRUE)
+        {
+            insert_name (db,DB_STMT_INSERT_PROVIDER,CACHE_GET_PROVIDER (cache) );
+            insert_cache_data (db,q,cache);
+        }
+        glyr_db_batch_end (db);
+    }
+}
 
-        GlyrQuery dummy;
-        dummy.number = G_MAXINT;
-        scb_data.query = &dummy;
-        scb_data.counter = 0;
-        scb_data.result = NULL;
+////////////////////////////////////
+////////////////////////////////////
+////////////////////////////////////
 
-        int rc = SQLITE_OK;
-        char * err_msg = NULL;
-        if ( (rc = sqlite3_exec (db->db_handle,sqlcode[SQL_FOREACH],select_callback,&scb_data,&err_msg) ) != SQLITE_OK)
+__attribute__ ( (visibility ("default") ) )
+int glyr_db_insert_batch (GlyrDatabase * db, GlyrQuery * q, GlyrMemCache * list)
+{
+    int inserted = 0;
+    if (db && q && list)
+    {
+        glyr_db_batch_begin (db);
+        if (insert_query_names (db,q) == TRUE)
         {
-            if (rc != SQLITE_ABORT)
+            const gchar * last_provider = NULL;
+            for (GlyrMemCache * cache = list; cache; cache = cache->next)
             {
-                glyr_message (-1,NULL,"SQL Foreach error: %s\n",err_msg);
+                /* Results are mostly grouped by provider */
+                const gchar * provider = CACHE_GET_PROVIDER (cache);
+                if (g_strcmp0 (provider,last_provider) != 0)
+                {
+                    insert_name (db,DB_STMT_INSERT_PROVIDER,provider);
+                    last_provider = provider;
+                }
+
+                if (insert_cache_data (db,q,cache) == TRUE)
+                {
+                    inserted++;
+                }
             }
-            sqlite3_free (err_msg);
         }
+        glyr_db_batch_end (db);
     }
+    return inserted;
 }
 
 ////////////////////////////////////
@@ -568,137 +810,172 @@ void glyr_db_foreach (GlyrDatabase * db, glyr_foreach_callback cb, void * userpt
 ////////////////////////////////////
 
 __attribute__ ( (visibility ("default") ) )
-GlyrMemCache * glyr_db_lookup (GlyrDatabase * db, GlyrQuery * query)
+void glyr_db_batch_begin (GlyrDatabase * db)
 {
-    GlyrMemCache * result = NULL;
-    if (db != NULL && query != NULL)
+    if (db != NULL)
     {
-        GLYR_FIELD_REQUIREMENT reqs = glyr_get_requirements (query->type);
-        gchar * artist_constr = "";
-        if ( (reqs & GLYR_REQUIRES_ARTIST) != 0)
+        /* Held till glyr_db_batch_end(), so other threads can't write into our transaction */
+        g_rec_mutex_lock (&db->statements->lock);
+        if (db->statements->batch_depth++ == 0)
         {
-            ADD_CONSTRAINT (artist_constr,"artist_name",query->artist);
-        }
-        gchar * album_constr  = "";
-        if ( (reqs & GLYR_REQUIRES_ALBUM ) != 0)
-        {
-            ADD_CONSTRAINT (album_constr,"album_name",query->album);
-        }
+            execute_statement (db,DB_STMT_BEGIN);
 
-        gchar * title_constr = "";
-        if ( (reqs & GLYR_REQUIRES_TITLE ) != 0)
-        {
-            ADD_CONSTRAINT (title_constr,"title_name",query->title);
+            /* Readers don't see the batch, lookups of this thread need to go to the writer */
+            g_atomic_pointer_set (&db->statements->batch_owner,g_thread_self() );
         }
+    }
+}
 
-        gchar * from_argument_list = convert_from_option_to_sql (query);
-        gchar * img_url_constr = "";
+////////////////////////////////////
+////////////////////////////////////
+////////////////////////////////////
 
-        if (TYPE_IS_IMAGE (query->type) )
+__attribute__ ( (visibility ("default") ) )
+void glyr_db_batch_end (GlyrDatabase * db)
+{
+    if (db != NULL)
+    {
+        if (--db->statements->batch_depth == 0)
         {
-            if (query->download == FALSE)
+            g_atomic_pointer_set (&db->statements->batch_owner,NULL);
+
+            /* Blobs of deleted rows may only go once the deletion is durable */
+            if (execute_statement (db,DB_STMT_COMMIT) == TRUE)
             {
-                img_url_constr = sqlite3_mprintf ("AND data_type = %d ", GLYR_TYPE_IMG_URL);
+                db_blob_release_deleted (db);
             }
             else
             {
-                img_url_constr = sqlite3_mprintf ("AND NOT data_type = %d ", GLYR_TYPE_IMG_URL);
+                execute_statement (db,DB_STMT_ROLLBACK);
             }
         }
+        g_rec_mutex_unlock (&db->statements->lock);
+    }
+}
 
-        gchar * sql = sqlite3_mprintf (sqlcode[SQL_LOOKUP],
-                                       query->type,
-                                       title_constr,
-                                       album_constr,
-                                       artist_constr,
-                                       img_url_constr,
-                                       from_argument_list,
-                                       query->number
-                                      );
-
+////////////////////////////////////
+////////////////////////////////////
+////////////////////////////////////
 
-        if (sql != NULL)
-        {
-            select_callback_data data;
-            data.result = &result;
-            data.query = query;
-            data.counter = 0;
-            data.cb = NULL;
-            data.userptr = NULL;
-
-            gchar * err_msg = NULL;
-            sqlite3_exec (db->db_handle,sql,select_callback,&data,&err_msg);
-            if (err_msg != NULL)
-            {
-                glyr_message (-1,NULL,"glyr_db_lookup: %s\n",err_msg);
-                sqlite3_free (err_msg);
-            }
-            sqlite3_free (sql);
-        }
+__attribute__ ( (visibility ("default") ) )
+void glyr_db_set_ttl (GlyrDatabase * db, GLYR_GET_TYPE type, double seconds)
+{
+    if (db != NULL && type > GLYR_GET_UNKNOWN && type < GLYR_GET_ANY)
+    {
+        g_mutex_lock (&db->policy->lock);
+        db->policy->ttl[type] = MAX (seconds,0);
+        g_mutex_unlock (&db->policy->lock);
+    }
+}
 
-#if DO_PROFILE
-        g_message ("Spent %.5f Seconds in Selectcallback.\n",select_callback_spent);
-        select_callback_spent = 0;
-#endif
+////////////////////////////////////
+////////////////////////////////////
+////////////////////////////////////
 
-        if (*artist_constr)
-        {
-            sqlite3_free (artist_constr);
-        }
-        if (*album_constr)
-        {
-            sqlite3_free (album_constr);
-        }
-        if (*title_constr)
-        {
-            sqlite3_free (title_constr);
-        }
+__attribute__ ( (visibility ("default") ) )
+void glyr_db_set_max_size (GlyrDatabase * db, size_t max_bytes)
+{
+    if (db != NULL)
+    {
+        g_mutex_lock (&db->policy->lock);
+        db->policy->max_size = max_bytes;
+        g_mutex_unlock (&db->policy->lock);
+    }
+}
 
-        g_free (from_argument_list);
+////////////////////////////////////
+////////////////////////////////////
+////////////////////////////////////
 
-        if (*img_url_constr != '\0')
-        {
-            sqlite3_free (img_url_constr);
-        }
+__attribute__ ( (visibility ("default") ) )
+void glyr_db_set_fuzzy_lookup (GlyrDatabase * db, unsigned int max_edits)
+{
+    if (db != NULL)
+    {
+        g_mutex_lock (&db->policy->lock);
+        db->policy->lookup_fuzz = max_edits;
+        g_mutex_unlock (&db->policy->lock);
     }
-    return result;
 }
 
 ////////////////////////////////////
 ////////////////////////////////////
 ////////////////////////////////////
 
+__attribute__ ( (visibility ("default") ) )
+void glyr_db_set_miss_ttl (GlyrDatabase * db, double seconds)
+{
+    if (db != NULL)
+    {
+        g_mutex_lock (&db->policy->lock);
+        db->policy->miss_ttl = MAX (seconds,0);
+        g_mutex_unlock (&db->policy->lock);
+    }
+}
+
+////////////////////////////////////
+////////////////////////////////////
+////////////////////////////////////
 
 __attribute__ ( (visibility ("default") ) )
-void glyr_db_insert (GlyrDatabase * db, GlyrQuery * q, GlyrMemCache * cache)
+int glyr_db_maintain (GlyrDatabase * db, unsigned int max_ms)
 {
-    if (db && q && cache)
+    gint removed = 0;
+    if (db == NULL)
     {
-        GLYR_FIELD_REQUIREMENT reqs = glyr_get_requirements (q->type);
-        execute (db,"BEGIN IMMEDIATE;");
-        if ( (reqs & GLYR_REQUIRES_ARTIST) || (reqs & GLYR_OPTIONAL_ARTIST) )
-        {
-            ABORT_ON_FAILED_REQS (reqs,GLYR_OPTIONAL_ARTIST,q->artist);
-            INSERT_STRING ("INSERT OR IGNORE INTO artists VALUES('%q');",q->artist);
-        }
-        if ( (reqs & GLYR_REQUIRES_ALBUM) || (reqs & GLYR_OPTIONAL_ALBUM) )
+        return 0;
+    }
+
+    gint64 deadline = (max_ms > 0) ? g_get_monotonic_time() + (gint64) max_ms * 1000 : G_MAXINT64;
+
+    g_mutex_lock (&db->policy->lock);
+    gdouble ttl[GLYR_GET_ANY];
+    memcpy (ttl,db->policy->ttl,sizeof (ttl) );
+    gint64 max_size = db->policy->max_size;
+    gdouble miss_ttl = db->policy->miss_ttl;
+    g_mutex_unlock (&db->policy->lock);
+
+    flush_accesses (db);
+
+    /* Expired items first, every slice is a transaction of its own so others can write in between */
+    gdouble now = get_current_time();
+    for (gint type = GLYR_GET_UNKNOWN + 1; type < GLYR_GET_ANY; type++)
+    {
+        gint deleted = (ttl[type] > 0) ? DB_MAINTAIN_SLICE : 0;
+        while (deleted == DB_MAINTAIN_SLICE && g_get_monotonic_time() < deadline)
         {
-            ABORT_ON_FAILED_REQS (reqs,GLYR_OPTIONAL_ALBUM,q->album);
-            INSERT_STRING ("INSERT OR IGNORE INTO albums  VALUES('%q');",q->album);
+            deleted = maintain_slice (db,DB_STMT_EXPIRE,type,now - ttl[type],NULL);
+            removed += deleted;
         }
-        if ( (reqs & GLYR_REQUIRES_TITLE) || (reqs & GLYR_OPTIONAL_TITLE) )
+    }
+
+    /* Misses are no items and not counted; with negative caching off all of them go */
+    gint forgotten = DB_MAINTAIN_SLICE;
+    while (forgotten == DB_MAINTAIN_SLICE && g_get_monotonic_time() < deadline)
+    {
+        forgotten = maintain_slice (db,DB_STMT_EXPIRE_MISSES,0,now - miss_ttl,NULL);
+    }
+
+    /* Then the least recently used ones, till everything fits.
+     * Summing up the blobs scans the whole table, so that's done once; each slice subtracts what it freed */
+    gint64 blob_bytes = (max_size > 0) ? single_value (db,DB_STMT_BLOB_BYTES) : 0;
+    while (max_size > 0 && g_get_monotonic_time() < deadline && db_file_size (db) + blob_bytes > max_size)
+    {
+        gint deleted = maintain_slice (db,DB_STMT_EVICT,0,0,&blob_bytes);
+        if (deleted == 0)
         {
-            ABORT_ON_FAILED_REQS (reqs,GLYR_OPTIONAL_TITLE,q->title);
-            INSERT_STRING ("INSERT OR IGNORE INTO titles  VALUES('%q');",q->title);
+            break;
         }
+        removed += deleted;
+    }
 
-        gchar * provider = CACHE_GET_PROVIDER (cache);
-        INSERT_STRING ("INSERT OR IGNORE INTO providers VALUES('%q');",provider);
-        insert_cache_data (db,q,cache);
-
-rollback:
-        execute (db,"COMMIT;");
+    /* Give free pages back (only databases created with auto_vacuum, otherwise nothing changes) */
+    while (g_get_monotonic_time() < deadline && maintain_slice (db,DB_STMT_VACUUM,0,0,NULL) > 0)
+    {
+        continue;
     }
+
+    return removed;
 }
 
 ////////////////////////////////////
@@ -738,36 +1015,227 @@ static void execute (GlyrDatabase * db, const gchar * sql_statement)
 ////////////////////////////////////
 ////////////////////////////////////
 
-/**
- *  Return the current time as double:
- *  <seconds>.<microseconds/one_second>
- */
-static double get_current_time (void)
+static gboolean execute_statement (GlyrDatabase * db, DBStatement id)
 {
-    struct timeval tim;
-    gettimeofday (&tim, NULL);
-    return (double) tim.tv_sec + ( (double) tim.tv_usec/1e6);
+    gboolean done = FALSE;
+    sqlite3_stmt * stmt = db_statement_acquire (db,id);
+    if (stmt != NULL)
+    {
+        done = (sqlite3_step (stmt) == SQLITE_DONE);
+        if (done == FALSE)
+        {
+            glyr_message (-1,NULL,"glyr_db_execute: SQL error: %s\n", sqlite3_errmsg (db->db_handle) );
+        }
+    }
+    db_statement_release (db,stmt);
+    return done;
 }
 
 ////////////////////////////////////
 
-static void insert_cache_data (GlyrDatabase * db, GlyrQuery * query, GlyrMemCache * cache)
+/* Insert the artist, album and title of q, if the type of q needs them.
+ * Returns FALSE if a required one is missing.
+ */
+static gboolean insert_query_names (GlyrDatabase * db, GlyrQuery * q)
 {
-    if (db && query && cache)
+    GLYR_FIELD_REQUIREMENT reqs = glyr_get_requirements (q->type);
+    if ( (reqs & GLYR_REQUIRES_ARTIST) || (reqs & GLYR_OPTIONAL_ARTIST) )
     {
-        int pos = 1;
-        char * sql = sqlite3_mprintf (sqlcode[SQL_INSERT_CACHE],
-                                      query->artist,
-                                      query->album,
-                                      query->title,
-                                      CACHE_GET_PROVIDER (cache),
-                                      cache->img_format
-                                     );
-
-        sqlite3_stmt *stmt = NULL;
-        sqlite3_prepare_v2 (db->db_handle, sql, strlen (sql) + 1, &stmt, NULL);
+        ABORT_ON_FAILED_REQS (reqs,GLYR_OPTIONAL_ARTIST,q->artist);
+        insert_name (db,DB_STMT_INSERT_ARTIST,q->artist);
+    }
+    if ( (reqs & GLYR_REQUIRES_ALBUM) || (reqs & GLYR_OPTIONAL_ALBUM) )
+    {
+        ABORT_ON_FAILED_REQS (reqs,GLYR_OPTIONAL_ALBUM,q->album);
+        insert_name (db,DB_STMT_INSERT_ALBUM,q->album);
+    }
+    if ( (reqs & GLYR_REQUIRES_TITLE) || (reqs & GLYR_OPTIONAL_TITLE) )
+    {
+        ABORT_ON_FAILED_REQS (reqs,GLYR_OPTIONAL_TITLE,q->title);
+        insert_name (db,DB_STMT_INSERT_TITLE,q->title);
+    }
+    return TRUE;
 
+rollback:
+    return FALSE;
+}
+
+////////////////////////////////////
+
+static void insert_name (GlyrDatabase * db, DBStatement id, const gchar * name)
+{
+    if (name != NULL)
+    {
+        /* We have to use _ascii_ here,
+         * since there seems to be some encoding problems
+         * in SQLite, which are triggered by comparing
+         * lower and highercase umlauts for example
+         * Simple encoding-indepent lowercase prevents it
+         */
+        sqlite3_stmt * stmt = db_statement_acquire (db,id);
+        sqlite3_bind_text (stmt,1,g_ascii_strdown (name,-1),-1,g_free);
+
+        /* Artists, albums and titles also store their lookup key */
+        if (sqlite3_bind_parameter_count (stmt) > 1)
+        {
+            sqlite3_bind_text (stmt,2,normalize_lookup_key (name),-1,g_free);
+        }
+        if (sqlite3_step (stmt) != SQLITE_DONE)
+        {
+            glyr_message (-1,NULL,"glyr_db_execute: SQL error: %s\n", sqlite3_errmsg (db->db_handle) );
+        }
+        db_statement_release (db,stmt);
+    }
+}
+
+////////////////////////////////////
+////////////////////////////////////
+////////////////////////////////////
+
+/* glyr_lookup_key(name) for SQL_UPGRADE_KEYS */
+static void lookup_key_function (sqlite3_context * context, int argc, sqlite3_value ** argv)
+{
+    const char * name = (const char *) sqlite3_value_text (argv[0]);
+    if (name != NULL)
+    {
+        sqlite3_result_text (context,normalize_lookup_key (name),-1,g_free);
+    }
+    else
+    {
+        sqlite3_result_null (context);
+    }
+}
+
+////////////////////////////////////
+
+/* glyr_url_hash(source_url) for SQL_UPGRADE_HASH */
+static void url_hash_function (sqlite3_context * context, int argc, sqlite3_value ** argv)
+{
+    const char * url = (const char *) sqlite3_value_text (argv[0]);
+    if (url != NULL)
+    {
+        sqlite3_result_int64 (context,db_url_hash (url) );
+    }
+    else
+    {
+        sqlite3_result_null (context);
+    }
+}
+
+////////////////////////////////////
+
+static gboolean has_column (GlyrDatabase * db, const gchar * table, const gchar * column)
+{
+    sqlite3_stmt * probe = NULL;
+    gchar * sql = sqlite3_mprintf ("SELECT %s FROM %s LIMIT 0;",column,table);
+    gboolean exists = (sqlite3_prepare_v2 (db->db_handle,sql,-1,&probe,NULL) == SQLITE_OK);
+
+    sqlite3_finalize (probe);
+    sqlite3_free (sql);
+    return exists;
+}
+
+////////////////////////////////////
+
+/* Databases written by older versions lack the newer columns */
+static void upgrade_schema (GlyrDatabase * db)
+{
+    if (has_column (db,"metadata","source_hash") == FALSE)
+    {
+        glyr_message (2,NULL,"glyr_db_init: Adding source_hash to %s\n",db->root_path);
+        sqlite3_create_function (db->db_handle,"glyr_url_hash",1,SQLITE_UTF8,NULL,url_hash_function,NULL,NULL);
+        execute (db,sqlcode[SQL_UPGRADE_HASH]);
+    }
+
+    /* Old rows keep their data inline, lookups read both */
+    if (has_column (db,"metadata","data_file") == FALSE)
+    {
+        execute (db,sqlcode[SQL_UPGRADE_BLOB]);
+    }
+
+    if (has_column (db,"metadata","last_access") == FALSE)
+    {
+        execute (db,sqlcode[SQL_UPGRADE_ACCESS]);
+    }
+
+    if (has_column (db,"artists","artist_key") == FALSE)
+    {
+        glyr_message (2,NULL,"glyr_db_init: Adding lookup keys to %s\n",db->root_path);
+        sqlite3_create_function (db->db_handle,"glyr_lookup_key",1,SQLITE_UTF8,NULL,lookup_key_function,NULL,NULL);
+        execute (db,sqlcode[SQL_UPGRADE_KEYS]);
+    }
+
+    execute (db,sqlcode[SQL_INDEX_DEF]);
+}
+
+////////////////////////////////////
+
+/* Fill the filter of db_contains() with everything in the db,
+ * sized so that the db can grow a bit before it gets unprecise
+ */
+static void load_known_items (GlyrDatabase * db)
+{
+    gint64 rows = 0;
+    sqlite3_stmt * stmt = NULL;
+
+    sqlite3_prepare_v2 (db->db_handle,"SELECT count(*) FROM metadata;",-1,&stmt,NULL);
+    if (sqlite3_step (stmt) == SQLITE_ROW)
+    {
+        rows = sqlite3_column_int64 (stmt,0);
+    }
+    sqlite3_finalize (stmt);
+
+    /* Checksum and url of every item, twice the number of them */
+    db->known_items = bloom_new (MAX (rows * 4,16384) );
+
+    stmt = NULL;
+    sqlite3_prepare_v2 (db->db_handle,"SELECT data_checksum,source_hash FROM metadata;",-1,&stmt,NULL);
+    while (sqlite3_step (stmt) == SQLITE_ROW)
+    {
+        if (sqlite3_column_bytes (stmt,0) == 16)
+        {
+            bloom_add (db->known_items,sqlite3_column_blob (stmt,0),16);
+        }
+        if (sqlite3_column_type (stmt,1) != SQLITE_NULL)
+        {
+            gint64 url_hash = sqlite3_column_int64 (stmt,1);
+            bloom_add (db->known_items,&url_hash,sizeof url_hash);
+        }
+    }
+    sqlite3_finalize (stmt);
+}
+
+////////////////////////////////////
+
+/**
+ *  Return the current time as double:
+ *  <seconds>.<microseconds/one_second>
+ */
+static double get_current_time (void)
+{
+    struct timeval tim;
+    gettimeofday (&tim, NULL);
+    return (double) tim.tv_sec + ( (double) tim.tv_usec/1e6);
+}
+
+////////////////////////////////////
+
+/* Returns TRUE if cache was not in the db yet */
+static gboolean insert_cache_data (GlyrDatabase * db, GlyrQuery * query, GlyrMemCache * cache)
+{
+    gboolean inserted = FALSE;
+    if (db && query && cache)
+    {
+        int pos = 1;
+        sqlite3_stmt * stmt = db_statement_acquire (db,DB_STMT_INSERT_CACHE);
+
+        sqlite3_bind_text (stmt, pos++, query->artist, -1, SQLITE_STATIC);
+        sqlite3_bind_text (stmt, pos++, query->album,  -1, SQLITE_STATIC);
+        sqlite3_bind_text (stmt, pos++, query->title,  -1, SQLITE_STATIC);
+        sqlite3_bind_text (stmt, pos++, CACHE_GET_PROVIDER (cache), -1, SQLITE_STATIC);
         SQL_BIND_TEXT (stmt,cache->dsrc,pos++);
+        sqlite3_bind_text (stmt, pos++, cache->img_format, -1, SQLITE_STATIC);
+
         sqlite3_bind_int (stmt, pos++, cache->duration);
         sqlite3_bind_int (stmt, pos++, query->type);
         sqlite3_bind_int (stmt, pos++, cache->type);
@@ -775,26 +1243,63 @@ static void insert_cache_data (GlyrDatabase * db, GlyrQuery * query, GlyrMemCach
         sqlite3_bind_int (stmt, pos++, cache->is_image);
         sqlite3_bind_blob (stmt,pos++, cache->md5sum, sizeof cache->md5sum, SQLITE_STATIC);
 
-        if (cache->data != NULL)
+        /* Large data goes to the blob dir, data stays NULL */
+        gchar * blob_key = NULL;
+        if (cache->data != NULL && cache->size >= DB_BLOB_MIN_SIZE)
+        {
+            blob_key = db_blob_put (db,cache->data,cache->size);
+        }
+
+        if (blob_key != NULL)
+        {
+            pos++;
+        }
+        else if (cache->data != NULL)
         {
             sqlite3_bind_blob (stmt, pos++, cache->data, cache->size, SQLITE_STATIC);
         }
         else
         {
             glyr_message (1,query,"glyr: Warning: Attempting to insert cache with missing data!\n");
+            pos++;
         }
 
+        gdouble now = get_current_time();
         sqlite3_bind_int (stmt, pos++, cache->rating);
-        sqlite3_bind_double (stmt,pos++, get_current_time() );
+        sqlite3_bind_double (stmt,pos++, now);
+
+        if (cache->dsrc != NULL)
+        {
+            sqlite3_bind_int64 (stmt, pos, db_url_hash (cache->dsrc) );
+        }
+        pos++;
+
+        sqlite3_bind_text (stmt, pos++, blob_key, -1, SQLITE_STATIC);
+        sqlite3_bind_double (stmt,pos++, now);
 
         if (sqlite3_step (stmt) != SQLITE_DONE)
         {
             glyr_message (1,query,"glyr_db_insert: SQL failure: %s\n", sqlite3_errmsg (db->db_handle) );
         }
+        else
+        {
+            inserted = (sqlite3_changes (db->db_handle) > 0);
+            db_remember (db,cache);
+        }
 
-        sqlite3_finalize (stmt);
-        sqlite3_free (sql);
+        db_statement_release (db,stmt);
+
+        /* The file was written before it was clear the row would be - no row, no file */
+        if (blob_key != NULL)
+        {
+            if (inserted == FALSE)
+            {
+                db_blob_release (db,blob_key);
+            }
+            g_free (blob_key);
+        }
     }
+    return inserted;
 }
 
 
@@ -803,236 +1308,800 @@ static void insert_cache_data (GlyrDatabase * db, GlyrQuery * query, GlyrMemCach
 ////////////////////////////////////
 ////////////////////////////////////
 
-#define DEBUG_LIST false
-
-static void add_to_cache_list (GlyrMemCache ** list, GlyrMemCache * to_add)
+/* Convert the current row of a SQL_LOOKUP or SQL_FOREACH statement to an actual Cache */
+static GlyrMemCache * cache_from_row (GlyrDatabase * db, sqlite3_stmt * stmt)
 {
-    if (to_add && list)
+#if DO_PROFILE
+    g_timer_start (row_timer);
+#endif
+
+    GlyrMemCache * cache = DL_init();
+
+    /* source_url is stored with its terminator, g_strdup() stops there */
+    cache->prov = g_strdup ( (const gchar *) sqlite3_column_text (stmt,3) );
+    cache->dsrc = g_strdup ( (const gchar *) sqlite3_column_text (stmt,4) );
+    cache->img_format = g_strdup ( (const gchar *) sqlite3_column_text (stmt,5) );
+
+    cache->duration  = sqlite3_column_int (stmt,6);
+    cache->type      = sqlite3_column_int (stmt,8);
+    cache->size      = sqlite3_column_int (stmt,9);
+    cache->is_image  = sqlite3_column_int (stmt,10);
+    cache->rating    = sqlite3_column_int (stmt,13);
+    cache->timestamp = sqlite3_column_double (stmt,14);
+
+    if (sqlite3_column_bytes (stmt,11) == sizeof (cache->md5sum) )
     {
-        GlyrMemCache * head = *list;
-        if (head == NULL)
+        memcpy (cache->md5sum,sqlite3_column_blob (stmt,11),sizeof (cache->md5sum) );
+    }
+
+    /* Blobs are handed out as they are, no conversion to text */
+    const void * data = sqlite3_column_blob (stmt,12);
+    gsize size = sqlite3_column_bytes (stmt,12);
+    if (data != NULL && size > 0)
+    {
+        cache->data = g_malloc (size + 1);
+        memcpy (cache->data,data,size);
+        cache->data[size] = 0;
+        cache->size = size;
+    }
+    else if (sqlite3_column_type (stmt,15) != SQLITE_NULL)
+    {
+        /* Stored in the blob dir - a row without its file is of no use */
+        cache->data = db_blob_get (db, (const gchar *) sqlite3_column_text (stmt,15),&size);
+        if (cache->data == NULL)
         {
-            /* Initialize list */
-            *list = to_add;
+            glyr_message (-1,NULL,"glyr: Skipping cached item without its data file %s\n",sqlite3_column_text (stmt,15) );
+            DL_free (cache);
+            return NULL;
         }
-        else
+        cache->size = size;
+    }
+
+    /* We're in the cache, so this one was cached.. :) */
+    cache->cached = TRUE;
+
+#if DO_PROFILE
+    g_timer_stop (row_timer);
+    row_spent += g_timer_elapsed (row_timer,NULL);
+#endif
+    return cache;
+}
+
+////////////////////////////////////
+////////////////////////////////////
+////////////////////////////////////
+
+/* Enabled providers as ",none,lastfm,...,", to be matched with instr() */
+static gchar * convert_from_option_to_list (GlyrQuery * q)
+{
+    GString * result = g_string_new (",none,");
+
+    for (GList * elem = r_getSList(); elem; elem = elem->next)
+    {
+        MetaDataSource * item = elem->data;
+        if (item && (q->type == item->type || item->type == GLYR_GET_ANY) )
         {
-            /* Find rating in list
-             * head will store the first non-matchin item,
-             * tail = head->prev
-             * */
-            GlyrMemCache * tail = head;
-            while (head && head->rating > to_add->rating)
+            if (provider_is_enabled (q,item) == TRUE)
             {
-                tail = head;
-                head = head->next;
+                g_string_append_printf (result,"%s,",item->name);
             }
+        }
+    }
+    return g_string_free (result,FALSE);
+}
 
+////////////////////////////////////
+////////////////////////////////////
+////////////////////////////////////
 
-            /* Now see what timestamp we have,
-             * and sort it accordingly, younger
-             * caches (== higher timestamp), are sorted
-             * at the start
-             */
-            if (head != NULL)
-            {
-                int last_rating = head->rating;
-                while (head && head->rating == last_rating && head->timestamp > to_add->timestamp)
-                {
-                    GlyrMemCache * p = head->next;
-                    if (p && p->rating == last_rating)
-                    {
-                        tail = head;
-                        head = p;
-                    }
-                    else if (p == NULL)
-                    {
-                        tail = head;
-                        head = p;
-                    }
-                    else break;
+static struct _GlyrDBStatements * statements_new (sqlite3 * db_handle)
+{
+    struct _GlyrDBStatements * statements = g_malloc0 (sizeof (struct _GlyrDBStatements) );
+    g_rec_mutex_init (&statements->lock);
 
-                }
-            }
+    for (int id = 0; id < DB_STMT_LAST; id++)
+    {
+        if (sqlite3_prepare_v2 (db_handle,stmtcode[id],-1,&statements->fixed[id],NULL) != SQLITE_OK)
+        {
+            glyr_message (-1,NULL,"glyr_db_init: Cannot compile statement: %s\n",sqlite3_errmsg (db_handle) );
+        }
+    }
+    return statements;
+}
 
-            /* Check if we're at the end of the list,
-             * If so just append it,
-             * else we insert to_add before head
-             */
-            g_assert (tail);
-            if (head != NULL)
-            {
-                GlyrMemCache * prev = head->prev;
-                if (prev != NULL)
-                    prev->next = to_add;
+////////////////////////////////////
+
+static void statements_free (struct _GlyrDBStatements * statements)
+{
+    if (statements != NULL)
+    {
+        for (int id = 0; id < DB_STMT_LAST; id++)
+        {
+            sqlite3_finalize (statements->fixed[id]);
+        }
+        for (int shape = 0; shape < SHAPE_COUNT; shape++)
+        {
+            sqlite3_finalize (statements->delete_shaped[shape]);
+        }
+        g_rec_mutex_clear (&statements->lock);
+        g_free (statements);
+    }
+}
 
-                to_add->prev = prev;
-                to_add->next = head;
+////////////////////////////////////
 
-                head->prev = to_add;
+sqlite3_stmt * db_statement_acquire (GlyrDatabase * db, DBStatement id)
+{
+    g_rec_mutex_lock (&db->statements->lock);
+    return db->statements->fixed[id];
+}
 
-                if (prev == NULL)
-                    *list = to_add;
-            }
-            else /* We're at the end */
-            {
-                tail->next = to_add;
-                to_add->prev = tail;
-            }
-        }
+////////////////////////////////////
+
+void db_statement_release (GlyrDatabase * db, sqlite3_stmt * stmt)
+{
+    if (stmt != NULL)
+    {
+        sqlite3_reset (stmt);
+        sqlite3_clear_bindings (stmt);
     }
+    g_rec_mutex_unlock (&db->statements->lock);
+}
 
-#if DEBUG_LIST
-    GlyrMemCache * p = *list;
-    while (p != NULL)
+////////////////////////////////////
+
+static int query_shape (GlyrQuery * query)
+{
+    GLYR_FIELD_REQUIREMENT reqs = glyr_get_requirements (query->type);
+    int shape = 0;
+
+    if ( (reqs & GLYR_REQUIRES_TITLE) != 0 && query->title != NULL)
     {
-        char * surr = (to_add == p) ? "*" : "|";
-        g_printerr ("%s(%d|%2.10f)%s %c ",surr,p->rating,p->timestamp,surr, (p->next) ? '-' : ' ');
-        p = p->next;
+        shape |= SHAPE_TITLE;
+    }
+    if ( (reqs & GLYR_REQUIRES_ALBUM) != 0 && query->album != NULL)
+    {
+        shape |= SHAPE_ALBUM;
+    }
+    if ( (reqs & GLYR_REQUIRES_ARTIST) != 0 && query->artist != NULL)
+    {
+        shape |= SHAPE_ARTIST;
     }
-    puts ("");
-#endif
 
+    /* Check if links are wanted */
+    if (TYPE_IS_IMAGE (query->type) )
+    {
+        shape |= (query->download == FALSE) ? SHAPE_LINKS_ONLY : SHAPE_NO_LINKS;
+    }
+    return shape;
 }
 
 ////////////////////////////////////
+
+/* Compile SQL_LOOKUP or SQL_DELETE (kind) with the constraints of shape */
+static sqlite3_stmt * prepare_shaped (sqlite3 * db_handle, int kind, int shape)
+{
+    /* Spaces in SQL statements just for pretty debug printing.
+     * Unary + keeps SQLite from scanning all items of a type when the name keys are more selective.
+     */
+    gchar * sql = sqlite3_mprintf (sqlcode[kind],
+                                   (shape & (SHAPE_TITLE | SHAPE_ALBUM | SHAPE_ARTIST) ) ? "+" : "",
+                                   (shape & SHAPE_TITLE)  ? "AND t.title_key  = :title " : "",
+                                   (shape & SHAPE_ALBUM)  ? "AND b.album_key  = :album " : "",
+                                   (shape & SHAPE_ARTIST) ? "AND a.artist_key = :artist" : "",
+                                   (shape & SHAPE_LINKS_ONLY) ? "AND     m.data_type = :link_type" :
+                                   (shape & SHAPE_NO_LINKS)   ? "AND NOT m.data_type = :link_type" : ""
+                                  );
+
+    sqlite3_stmt * stmt = NULL;
+    if (sqlite3_prepare_v2 (db_handle,sql,-1,&stmt,NULL) != SQLITE_OK)
+    {
+        glyr_message (-1,NULL,"Cannot compile statement: %s\n",sqlite3_errmsg (db_handle) );
+    }
+    sqlite3_free (sql);
+    return stmt;
+}
+
 ////////////////////////////////////
+
+/* Like db_statement_acquire(), for the SQL_DELETE fitting query */
+static sqlite3_stmt * delete_acquire (GlyrDatabase * db, GlyrQuery * query)
+{
+    int shape = query_shape (query);
+
+    g_rec_mutex_lock (&db->statements->lock);
+    if (db->statements->delete_shaped[shape] == NULL)
+    {
+        db->statements->delete_shaped[shape] = prepare_shaped (db->db_handle,SQL_DELETE,shape);
+    }
+    return db->statements->delete_shaped[shape];
+}
+
 ////////////////////////////////////
 
-/* Convert a single result from the DB to an actual Cache */
-static int select_callback (void * result, int argc, char ** argv, char ** azColName)
+static void setup_connection (sqlite3 * db_handle)
 {
-#if DO_PROFILE
-    g_timer_start (select_callback_timer);
-#endif
+    sqlite3_busy_timeout (db_handle,DB_BUSY_WAIT);
+
+    gchar * sql = sqlite3_mprintf ("PRAGMA mmap_size = %d;",DB_MMAP_SIZE);
+    sqlite3_exec (db_handle,sql,NULL,NULL,NULL);
+    sqlite3_free (sql);
+}
+
+////////////////////////////////////
+
+static void reader_finalize (DBReader * reader)
+{
+    for (int id = 0; id < DB_STMT_LAST; id++)
+    {
+        sqlite3_finalize (reader->fixed[id]);
+        reader->fixed[id] = NULL;
+    }
+    for (int shape = 0; shape < SHAPE_COUNT; shape++)
+    {
+        sqlite3_finalize (reader->lookup[shape]);
+        reader->lookup[shape] = NULL;
+    }
+}
+
+////////////////////////////////////
+
+static DBReader * reader_open (const gchar * path)
+{
+    sqlite3 * db_handle = NULL;
+    if (sqlite3_open_v2 (path,&db_handle,SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX,NULL) != SQLITE_OK)
+    {
+        glyr_message (-1,NULL,"Opening a reader for %s failed: %s\n",path,sqlite3_errmsg (db_handle) );
+        sqlite3_close (db_handle);
+        return NULL;
+    }
+
+    setup_connection (db_handle);
 
+    DBReader * reader = g_malloc0 (sizeof (DBReader) );
+    reader->handle = db_handle;
+    return reader;
+}
+
+////////////////////////////////////
+
+static struct _GlyrDBReaders * readers_new (const gchar * path, sqlite3 * writer)
+{
+    struct _GlyrDBReaders * readers = g_malloc0 (sizeof (struct _GlyrDBReaders) );
+    readers->path = g_strdup (path);
+    readers->idle = g_async_queue_new();
+    readers->max_opened = MAX (g_get_num_processors(),2);
+    readers->writer.handle = writer;
+    g_mutex_init (&readers->lock);
+    return readers;
+}
 
-    int rc = 0;
-    select_callback_data * data = result;
-    GlyrMemCache ** list = data->result;
+////////////////////////////////////
 
-    if (argc >= 15 && data->counter < data->query->number)
+static void readers_free (struct _GlyrDBReaders * readers)
+{
+    if (readers != NULL)
     {
-        GlyrMemCache * cache = DL_init();
-        if (cache != NULL)
+        for (GList * elem = readers->opened; elem; elem = elem->next)
         {
-            cache->prov = g_strdup (argv[3]);
-            cache->dsrc = g_strdup (argv[4]);
-            cache->img_format = g_strdup (argv[5]);
+            DBReader * reader = elem->data;
+            reader_finalize (reader);
+            sqlite3_close (reader->handle);
+            g_free (reader);
+        }
+        g_list_free (readers->opened);
+
+        /* The writer is closed by glyr_db_destroy() */
+        reader_finalize (&readers->writer);
+
+        g_async_queue_unref (readers->idle);
+        g_mutex_clear (&readers->lock);
+        g_free (readers->path);
+        g_free (readers);
+    }
+}
+
+////////////////////////////////////
 
-            cache->duration = (argv[6]  ? strtol (argv[6],NULL,10)   : 0);
-            cache->type =     (argv[8]  ? strtol (argv[8],NULL,10)   : 0);
-            cache->size =     (argv[9]  ? strtol (argv[9],NULL,10)   : 0);
-            cache->is_image = (argv[10] ? strtol (argv[10],NULL,10) : 0);
+DBReader * db_reader_acquire (GlyrDatabase * db)
+{
+    struct _GlyrDBReaders * readers = db->readers;
+    DBReader * reader = NULL;
 
-            if (argv[11] != NULL)
+    if (g_atomic_pointer_get (&db->statements->batch_owner) != g_thread_self() )
+    {
+        reader = g_async_queue_try_pop (readers->idle);
+        if (reader == NULL)
+        {
+            g_mutex_lock (&readers->lock);
+            gboolean may_open = g_list_length (readers->opened) < readers->max_opened;
+            if (may_open)
             {
-                memcpy (cache->md5sum,argv[11],16);
+                reader = reader_open (readers->path);
+                if (reader != NULL)
+                {
+                    readers->opened = g_list_prepend (readers->opened,reader);
+                }
             }
+            g_mutex_unlock (&readers->lock);
 
-            if (argv[12] != NULL && cache->size > 0)
+            /* All busy - wait for one to come back */
+            if (may_open == FALSE)
             {
-                cache->data = g_malloc0 (cache->size + 1);
-                memcpy (cache->data,argv[12],cache->size);
-                cache->data[cache->size] = 0;
+                reader = g_async_queue_pop (readers->idle);
             }
+        }
+    }
 
-            cache->rating = (argv[13] ? strtol (argv[13],NULL,10) : 0);
+    if (reader == NULL)
+    {
+        g_rec_mutex_lock (&db->statements->lock);
+        reader = &readers->writer;
+    }
+    return reader;
+}
 
-            /* Timestamp */
-            if (argv[14] != NULL)
-            {
-                /* Normal strtod() cuts off part behin the comma.. */
-                cache->timestamp = (argv[14] ? g_ascii_strtod (argv[14],NULL) : 0);
-            }
+////////////////////////////////////
 
-            /* We're in the cache, so this one was cached.. :) */
-            cache->cached = TRUE;
+sqlite3_stmt * db_reader_statement (DBReader * reader, DBStatement id)
+{
+    if (reader->fixed[id] == NULL)
+    {
+        if (sqlite3_prepare_v2 (reader->handle,stmtcode[id],-1,&reader->fixed[id],NULL) != SQLITE_OK)
+        {
+            glyr_message (-1,NULL,"Cannot compile statement: %s\n",sqlite3_errmsg (reader->handle) );
+        }
+    }
+    return reader->fixed[id];
+}
 
-            if (list != NULL)
-            {
-                add_to_cache_list (list,cache);
-            }
-            else if (data->cb != NULL && cache)
-            {
-                GlyrQuery q;
-                glyr_query_init (&q);
+////////////////////////////////////
 
-                if (argv[7] != NULL)
-                {
-                    GLYR_GET_TYPE type = strtol (argv[7],NULL,10);
-                    glyr_opt_type (&q,type);
-                }
+static sqlite3_stmt * reader_lookup_statement (DBReader * reader, GlyrQuery * query)
+{
+    int shape = query_shape (query);
+    if (reader->lookup[shape] == NULL)
+    {
+        reader->lookup[shape] = prepare_shaped (reader->handle,SQL_LOOKUP,shape);
+    }
+    return reader->lookup[shape];
+}
 
-                glyr_opt_artist (&q,argv[0]);
-                glyr_opt_album (&q, argv[1]);
-                glyr_opt_title (&q, argv[2]);
+////////////////////////////////////
 
-                rc = data->cb (&q,cache,data->userptr);
+void db_reader_release (GlyrDatabase * db, DBReader * reader, sqlite3_stmt * stmt)
+{
+    if (stmt != NULL)
+    {
+        sqlite3_reset (stmt);
+        sqlite3_clear_bindings (stmt);
+    }
 
-                glyr_query_destroy (&q);
-                DL_free (cache);
-            }
-        }
+    if (reader == &db->readers->writer)
+    {
+        g_rec_mutex_unlock (&db->statements->lock);
     }
+    else if (reader != NULL)
+    {
+        g_async_queue_push (db->readers->idle,reader);
+    }
+}
 
-    data->counter++;
-#if DO_PROFILE
-    g_timer_stop (select_callback_timer);
-    select_callback_spent += g_timer_elapsed (select_callback_timer,NULL);
-#endif
-    return rc;
+////////////////////////////////////
+
+/* Names are compared by their normalized key, so spelling variants match */
+static void bind_named_key (sqlite3_stmt * stmt, const char * name, const gchar * text)
+{
+    int index = sqlite3_bind_parameter_index (stmt,name);
+    if (index > 0 && text != NULL)
+    {
+        sqlite3_bind_text (stmt,index,normalize_lookup_key (text),-1,g_free);
+    }
 }
 
 ////////////////////////////////////
+
+/* Bind the constraints of query to a SQL_LOOKUP or SQL_DELETE statement */
+static void bind_query (sqlite3_stmt * stmt, GlyrQuery * query)
+{
+    bind_named_key (stmt,":title", query->title);
+    bind_named_key (stmt,":album", query->album);
+    bind_named_key (stmt,":artist",query->artist);
+
+    gchar * providers = convert_from_option_to_list (query);
+    sqlite3_bind_text (stmt,sqlite3_bind_parameter_index (stmt,":providers"),providers,-1,g_free);
+
+    sqlite3_bind_int (stmt,sqlite3_bind_parameter_index (stmt,":type"),query->type);
+    sqlite3_bind_int (stmt,sqlite3_bind_parameter_index (stmt,":limit"),query->number);
+
+    int link_type = sqlite3_bind_parameter_index (stmt,":link_type");
+    if (link_type > 0)
+    {
+        sqlite3_bind_int (stmt,link_type,GLYR_TYPE_IMG_URL);
+    }
+}
+
+
 ////////////////////////////////////
+
+/* Read all rows of a bound SQL_LOOKUP statement, and reset it */
+static GlyrMemCache * step_lookup (GlyrDatabase * db, sqlite3_stmt * stmt)
+{
+    GlyrMemCache * result = NULL;
+
+    /* Rows come sorted by rating and timestamp already */
+    GlyrMemCache * last = NULL;
+    gdouble now = get_current_time();
+    int rc;
+    while ( (rc = sqlite3_step (stmt) ) == SQLITE_ROW)
+    {
+        GlyrMemCache * cache = cache_from_row (db,stmt);
+        if (cache == NULL)
+        {
+            continue;
+        }
+
+        note_access (db,sqlite3_column_int64 (stmt,16),now);
+        cache->prev = last;
+        if (last != NULL)
+        {
+            last->next = cache;
+        }
+        else
+        {
+            result = cache;
+        }
+        last = cache;
+    }
+
+    if (rc != SQLITE_DONE)
+    {
+        glyr_message (-1,NULL,"glyr_db_lookup: %s\n",sqlite3_errmsg (sqlite3_db_handle (stmt) ) );
+    }
+    sqlite3_reset (stmt);
+    return result;
+}
+
 ////////////////////////////////////
 
-static gchar * convert_from_option_to_sql (GlyrQuery * q)
+/* The stored key closest to key, if it's at most fuzz edits (and a quarter of its length) away.
+ * Only keys with the same first character are looked at, so this stays an index range scan.
+ */
+static gchar * nearest_key (DBReader * reader, DBStatement id, const gchar * key, gsize fuzz)
 {
-    gchar * result = g_strdup ("'none'");
+    sqlite3_stmt * stmt = db_reader_statement (reader,id);
+    if (stmt == NULL || key[0] == '\0')
+    {
+        return NULL;
+    }
 
-    for (GList * elem = r_getSList(); elem; elem = elem->next)
+    /* [first char, first char + 1) in byte order */
+    gsize prefix_len = g_utf8_next_char (key) - key;
+    gchar * upper = g_strndup (key,prefix_len);
+    upper[prefix_len - 1]++;
+
+    sqlite3_bind_text (stmt,1,key,prefix_len,SQLITE_STATIC);
+    sqlite3_bind_text (stmt,2,upper,-1,g_free);
+
+    gchar * nearest = NULL;
+    gsize nearest_diff = MIN (fuzz,g_utf8_strlen (key,-1) / 4) + 1;
+    while (sqlite3_step (stmt) == SQLITE_ROW)
     {
-        MetaDataSource * item = elem->data;
-        if (item && (q->type == item->type || item->type == GLYR_GET_ANY) )
+        const gchar * other = (const gchar *) sqlite3_column_text (stmt,0);
+        if (other != NULL && g_strcmp0 (other,key) != 0)
         {
-            if (provider_is_enabled (q,item) == TRUE)
+            gsize diff = levenshtein_safe_strcmp (key,other);
+            if (diff < nearest_diff)
             {
-                gchar * old_mem = result;
-                result = g_strdup_printf ("%s%s'%s'",result, (*result) ? "," : "",item->name);
-                g_free (old_mem);
+                g_free (nearest);
+                nearest = g_strdup (other);
+                nearest_diff = diff;
             }
         }
     }
+
+    sqlite3_reset (stmt);
+    sqlite3_clear_bindings (stmt);
+    return nearest;
+}
+
+////////////////////////////////////
+
+/* Nothing found for the exact keys - try again with a slightly misspelled artist, album or title,
+ * one at a time, before the caller goes to the network
+ */
+static GlyrMemCache * fuzzy_lookup (GlyrDatabase * db, DBReader * reader, sqlite3_stmt * stmt, GlyrQuery * query)
+{
+    const struct
+    {
+        const char * param;
+        const gchar * name;
+        DBStatement near_stmt;
+    }
+    fields[] =
+    {
+        {":artist",query->artist,DB_STMT_NEAR_ARTIST},
+        {":album", query->album, DB_STMT_NEAR_ALBUM },
+        {":title", query->title, DB_STMT_NEAR_TITLE }
+    };
+
+    g_mutex_lock (&db->policy->lock);
+    guint fuzz = db->policy->lookup_fuzz;
+    g_mutex_unlock (&db->policy->lock);
+
+    GlyrMemCache * result = NULL;
+    for (gsize i = 0; i < G_N_ELEMENTS (fields) && result == NULL && fuzz > 0; i++)
+    {
+        int index = sqlite3_bind_parameter_index (stmt,fields[i].param);
+        if (index == 0 || fields[i].name == NULL)
+        {
+            continue;
+        }
+
+        gchar * key = normalize_lookup_key (fields[i].name);
+        gchar * similar = nearest_key (reader,fields[i].near_stmt,key,fuzz);
+        if (similar != NULL)
+        {
+            glyr_message (2,query,"glyr_db_lookup: Trying '%s' instead of '%s'\n",similar,key);
+            sqlite3_bind_text (stmt,index,similar,-1,g_free);
+            result = step_lookup (db,stmt);
+            sqlite3_bind_text (stmt,index,key,-1,g_free);
+        }
+        else
+        {
+            g_free (key);
+        }
+    }
     return result;
 }
 
 ////////////////////////////////////
+
+/* Note that a lookup returned rowid; written by flush_accesses() */
+static void note_access (GlyrDatabase * db, gint64 rowid, gdouble now)
+{
+    g_mutex_lock (&db->policy->lock);
+    if (db->policy->accessed->len < DB_ACCESS_LOG_MAX)
+    {
+        DBAccess access = {rowid,now};
+        g_array_append_val (db->policy->accessed,access);
+    }
+    g_mutex_unlock (&db->policy->lock);
+}
+
 ////////////////////////////////////
+
+static void flush_accesses (GlyrDatabase * db)
+{
+    g_mutex_lock (&db->policy->lock);
+    GArray * accessed = db->policy->accessed;
+    db->policy->accessed = g_array_new (FALSE,FALSE,sizeof (DBAccess) );
+    g_mutex_unlock (&db->policy->lock);
+
+    if (accessed->len > 0)
+    {
+        glyr_db_batch_begin (db);
+        sqlite3_stmt * stmt = db_statement_acquire (db,DB_STMT_TOUCH);
+        for (guint i = 0; stmt != NULL && i < accessed->len; i++)
+        {
+            DBAccess * access = &g_array_index (accessed,DBAccess,i);
+            sqlite3_bind_int64 (stmt,1,access->rowid);
+            sqlite3_bind_double (stmt,2,access->time);
+            sqlite3_step (stmt);
+            sqlite3_reset (stmt);
+        }
+        db_statement_release (db,stmt);
+        glyr_db_batch_end (db);
+    }
+    g_array_free (accessed,TRUE);
+}
+
 ////////////////////////////////////
 
-static int delete_callback (void * result, int argc, char ** argv, char ** azColName)
+static gint64 single_value (GlyrDatabase * db, DBStatement id)
 {
-    delete_callback_data * data = result;
-    if (argc >= 4 && result && data->max_delete > data->deleted)
+    gint64 value = 0;
+    sqlite3_stmt * stmt = db_statement_acquire (db,id);
+    if (stmt != NULL && sqlite3_step (stmt) == SQLITE_ROW)
     {
-        /* God, this is so silly.. SQL, why you don't like " = null"
-         * I can't think of any easier way to do this, tell me if you found one
-         */
-        gchar * sql_delete = sqlite3_mprintf (sqlcode[SQL_ACTUAL_DELETE],
-                                              argv[0] ? "=" : " IS ", argv[0] ? argv[0] : "NULL",
-                                              argv[1] ? "=" : " IS ", argv[1] ? argv[1] : "NULL",
-                                              argv[2] ? "=" : " IS ", argv[2] ? argv[2] : "NULL",
-                                              argv[3] ? "=" : " IS ", argv[3] ? argv[3] : "NULL",
-                                              argv[4] ? "=" : " IS ", argv[4] ? argv[4] : "NULL");
-
-        if (sql_delete != NULL)
+        value = sqlite3_column_int64 (stmt,0);
+    }
+    db_statement_release (db,stmt);
+    return value;
+}
+
+////////////////////////////////////
+
+/* Bytes used by the db file, without free pages */
+static gint64 db_file_size (GlyrDatabase * db)
+{
+    gint64 pages = single_value (db,DB_STMT_PAGE_COUNT) - single_value (db,DB_STMT_FREELIST_COUNT);
+    return pages * single_value (db,DB_STMT_PAGE_SIZE);
+}
+
+////////////////////////////////////
+
+/* One step of glyr_db_maintain() in its own transaction:
+ * DB_STMT_EXPIRE deletes items of type older than before, DB_STMT_EXPIRE_MISSES misses older than before,
+ * DB_STMT_EVICT the least recently used items, DB_STMT_VACUUM frees pages.
+ * If blob_bytes is given, the size of the blobs no row uses anymore is subtracted from it.
+ * Returns the number of deleted rows or freed pages, at most DB_MAINTAIN_SLICE.
+ */
+static gint maintain_slice (GlyrDatabase * db, DBStatement id, gint type, gdouble before, gint64 * blob_bytes)
+{
+    gint done = 0;
+    glyr_db_batch_begin (db);
+
+    gint64 free_pages = (id == DB_STMT_VACUUM) ? single_value (db,DB_STMT_FREELIST_COUNT) : 0;
+
+    /* An outer batch may have released blobs already */
+    gint64 released = (blob_bytes != NULL) ? single_value (db,DB_STMT_RELEASED_BYTES) : 0;
+
+    sqlite3_stmt * stmt = db_statement_acquire (db,id);
+    if (stmt != NULL)
+    {
+        if (id == DB_STMT_EXPIRE)
+        {
+            sqlite3_bind_int (stmt,1,type);
+            sqlite3_bind_double (stmt,2,before);
+            sqlite3_bind_int (stmt,3,DB_MAINTAIN_SLICE);
+        }
+        else if (id == DB_STMT_EXPIRE_MISSES)
+        {
+            sqlite3_bind_double (stmt,1,before);
+            sqlite3_bind_int (stmt,2,DB_MAINTAIN_SLICE);
+        }
+        else if (id == DB_STMT_EVICT)
+        {
+            sqlite3_bind_int (stmt,1,DB_MAINTAIN_SLICE);
+        }
+
+        int rc;
+        while ( (rc = sqlite3_step (stmt) ) == SQLITE_ROW)
+        {
+            continue;
+        }
+
+        if (rc != SQLITE_DONE)
+        {
+            glyr_message (-1,NULL,"glyr_db_maintain: %s\n",sqlite3_errmsg (db->db_handle) );
+        }
+        else if (id == DB_STMT_VACUUM)
+        {
+            done = free_pages - single_value (db,DB_STMT_FREELIST_COUNT);
+        }
+        else
+        {
+            done = sqlite3_changes (db->db_handle);
+        }
+    }
+    db_statement_release (db,stmt);
+
+    if (blob_bytes != NULL && done > 0)
+    {
+        *blob_bytes -= single_value (db,DB_STMT_RELEASED_BYTES) - released;
+    }
+
+    glyr_db_batch_end (db);
+    return done;
+}
+
+////////////////////////////////////
+
+/* The normalized artist, album and title of query, as far as its type uses them,
+ * and the other options that change what a provider may find: language and image size
+ */
+static gchar * miss_key (GlyrQuery * query)
+{
+    GLYR_FIELD_REQUIREMENT reqs = glyr_get_requirements (query->type);
+    struct
+    {
+        gint mask;
+        const gchar * name;
+    } fields[] =
+    {
+        {GLYR_REQUIRES_ARTIST | GLYR_OPTIONAL_ARTIST,query->artist},
+        {GLYR_REQUIRES_ALBUM  | GLYR_OPTIONAL_ALBUM, query->album },
+        {GLYR_REQUIRES_TITLE  | GLYR_OPTIONAL_TITLE, query->title }
+    };
+
+    GString * key = g_string_new (NULL);
+    for (gsize i = 0; i < G_N_ELEMENTS (fields); i++)
+    {
+        if ( (reqs & fields[i].mask) != 0 && fields[i].name != NULL)
+        {
+            gchar * part = normalize_lookup_key (fields[i].name);
+            g_string_append (key,part);
+            g_free (part);
+        }
+        g_string_append_c (key,'\t');
+    }
+
+    g_string_append (key,(query->lang != NULL) ? query->lang : "");
+    if (TYPE_IS_IMAGE (query->type) )
+    {
+        g_string_append_printf (key,"\t%d-%d",query->img_min_size,query->img_max_size);
+    }
+    return g_string_free (key,FALSE);
+}
+
+////////////////////////////////////
+
+gdouble db_miss_ttl (GlyrDatabase * db)
+{
+    gdouble miss_ttl = 0;
+    if (db != NULL)
+    {
+        g_mutex_lock (&db->policy->lock);
+        miss_ttl = db->policy->miss_ttl;
+        g_mutex_unlock (&db->policy->lock);
+    }
+    return miss_ttl;
+}
+
+////////////////////////////////////
+
+GHashTable * db_miss_lookup (GlyrDatabase * db, GlyrQuery * query)
+{
+    GHashTable * misses = NULL;
+    if (db == NULL || query == NULL)
+    {
+        return NULL;
+    }
+
+    gdouble miss_ttl = db_miss_ttl (db);
+    if (miss_ttl > 0)
+    {
+        DBReader * reader = db_reader_acquire (db);
+        sqlite3_stmt * stmt = db_reader_statement (reader,DB_STMT_RECENT_MISSES);
+        if (stmt != NULL)
+        {
+            sqlite3_bind_int (stmt,1,query->type);
+            sqlite3_bind_text (stmt,2,miss_key (query),-1,g_free);
+            sqlite3_bind_double (stmt,3,get_current_time() - miss_ttl);
+
+            while (sqlite3_step (stmt) == SQLITE_ROW)
+            {
+                const gchar * provider = (const gchar *) sqlite3_column_text (stmt,0);
+                if (provider != NULL)
+                {
+                    if (misses == NULL)
+                    {
+                        misses = g_hash_table_new_full (g_str_hash,g_str_equal,g_free,NULL);
+                    }
+                    g_hash_table_add (misses,g_strdup (provider) );
+                }
+            }
+        }
+        db_reader_release (db,reader,stmt);
+    }
+    return misses;
+}
+
+////////////////////////////////////
+
+void db_miss_update (GlyrDatabase * db, GlyrQuery * query, const gchar * provider, gboolean found)
+{
+    if (db == NULL || query == NULL || provider == NULL || (found == FALSE && db_miss_ttl (db) <= 0) )
+    {
+        return;
+    }
+
+    sqlite3_stmt * stmt = db_statement_acquire (db,(found) ? DB_STMT_FORGET_MISS : DB_STMT_INSERT_MISS);
+    if (stmt != NULL)
+    {
+        sqlite3_bind_int (stmt,1,query->type);
+        sqlite3_bind_text (stmt,2,miss_key (query),-1,g_free);
+        sqlite3_bind_text (stmt,3,provider,-1,SQLITE_STATIC);
+        if (found == FALSE)
+        {
+            sqlite3_bind_double (stmt,4,get_current_time() );
+        }
+
+        if (sqlite3_step (stmt) != SQLITE_DONE)
         {
-            execute (data->con,sql_delete);
-            sqlite3_free (sql_delete);
-            data->deleted++;
+            glyr_message (-1,NULL,"glyr: Cannot remember miss of %s: %s\n",provider,sqlite3_errmsg (db->db_handle) );
         }
     }
-    return 0;
+    db_statement_release (db,stmt);
 }
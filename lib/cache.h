@@ -113,7 +113,8 @@ extern "C"
     * @query: Define what to search for
     *
     * The artist,album,title and type field are used to query
-    * the database.
+    * the database. Names are compared in a normalized form,
+    * so "Beatles, The", "the beatles" and "The Beatles (Remastered)" find the same items.
     *
     * If you used glyr_opt_lookup_db() to bind the DB to a query,
     * You may use glyr_get() as an alternative for this method.
@@ -138,6 +139,9 @@ extern "C"
     * </listitem>
     * </itemizedlist>
     *
+    * If nothing matches exactly and glyr_db_set_fuzzy_lookup() is set, a stored
+    * artist, album or title a few edits away is tried instead.
+    *
     * Returns: A newly allocated #GlyrMemCache or NULL if nothing found
     */
     GlyrMemCache * glyr_db_lookup (GlyrDatabase * db, GlyrQuery * query);
@@ -152,6 +156,39 @@ extern "C"
     */
     void glyr_db_insert (GlyrDatabase * db, GlyrQuery * q, GlyrMemCache * cache);
 
+    /**
+    * glyr_db_insert_batch:
+    * @db: A database connection
+    * @q: The query that was used to retrieve the items
+    * @list: The first cache of a list, linked via ->next
+    *
+    * Like glyr_db_insert(), but all items of @list are written in one transaction,
+    * which is a lot faster than inserting them one by one.
+    *
+    * Returns: The number of items that were not in the db yet.
+    */
+    int glyr_db_insert_batch (GlyrDatabase * db, GlyrQuery * q, GlyrMemCache * list);
+
+    /**
+    * glyr_db_batch_begin:
+    * @db: A database connection
+    *
+    * Every insert till the matching glyr_db_batch_end() is written in one transaction,
+    * e.g. to store the results of many queries at once.
+    * Calls may be nested; both need to be called by the same thread,
+    * other threads using @db wait till the batch is done.
+    */
+    void glyr_db_batch_begin (GlyrDatabase * db);
+
+    /**
+    * glyr_db_batch_end:
+    * @db: A database connection
+    *
+    * Ends a batch started by glyr_db_batch_begin(), and writes it to disk
+    * if it's the outermost one.
+    */
+    void glyr_db_batch_end (GlyrDatabase * db);
+
     /**
     * glyr_db_delete:
     * @db: The Database
@@ -279,6 +316,70 @@ extern "C"
     void glyr_db_foreach (GlyrDatabase * db, glyr_foreach_callback cb, void * userptr);
 
 
+    /**
+    * glyr_db_set_ttl:
+    * @db: A database connection
+    * @type: The type of items that should expire
+    * @seconds: Max. age of an item, 0 to keep them forever (the default)
+    *
+    * Items of @type older than @seconds are deleted by the next glyr_db_maintain().
+    */
+    void glyr_db_set_ttl (GlyrDatabase * db, GLYR_GET_TYPE type, double seconds);
+
+    /**
+    * glyr_db_set_max_size:
+    * @db: A database connection
+    * @max_bytes: Max. size of the database and its stored files, 0 for no limit (the default)
+    *
+    * If the cache grows larger, glyr_db_maintain() deletes the least recently used items.
+    */
+    void glyr_db_set_max_size (GlyrDatabase * db, size_t max_bytes);
+
+    /**
+    * glyr_db_set_fuzzy_lookup:
+    * @db: A database connection
+    * @max_edits: Max. edits between a searched and a stored name, 0 to match exactly (the default)
+    *
+    * If glyr_db_lookup() (and therefore glyr_get()) finds nothing, try a stored artist, album
+    * or title at most @max_edits (and a quarter of its length) away instead.
+    * Mind that this returns items of similar names, e.g. "Hell" for "Help".
+    */
+    void glyr_db_set_fuzzy_lookup (GlyrDatabase * db, unsigned int max_edits);
+
+    /**
+    * glyr_db_set_miss_ttl:
+    * @db: A database connection
+    * @seconds: How long a miss is remembered, 0 to always ask every provider (the default).
+    *
+    * If a provider answers a glyr_get() but has nothing for it, @db remembers this miss
+    * for the type, artist, album, title, language and image size limits of the query
+    * (names are compared like in glyr_db_lookup()).
+    * Later queries with glyr_opt_lookup_db() and glyr_opt_db_autoread() do not ask that provider
+    * again till @seconds passed, and don't go online at all if every provider had nothing.
+    * Misses are only written with glyr_opt_db_autowrite(); failed downloads are no misses.
+    * A page the provider's parser does not understand (e.g. a changed layout or a captcha)
+    * counts as a miss though, so keep @seconds short enough for such cases to heal.
+    */
+    void glyr_db_set_miss_ttl (GlyrDatabase * db, double seconds);
+
+    /**
+    * glyr_db_maintain:
+    * @db: A database connection
+    * @max_ms: Stop after about this many milliseconds, 0 for no limit.
+    *
+    * Deletes expired items (see glyr_db_set_ttl()), then the least recently used ones
+    * till the cache fits into glyr_db_set_max_size(), forgets misses older than
+    * glyr_db_set_miss_ttl(), and gives free space back
+    * (only for databases created with this version, older ones keep their size).
+    * The work is done in small transactions, other threads may use @db in between.
+    * Call it from time to time, e.g. every few minutes in long running programs;
+    * what's left after @max_ms is done by the next call.
+    *
+    * Returns: The number of deleted items.
+    */
+    int glyr_db_maintain (GlyrDatabase * db, unsigned int max_ms);
+
+
     /**
      * glyr_db_make_dummy:
      *
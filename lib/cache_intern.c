@@ -21,7 +21,149 @@
 #include "glyr.h"
 #include "cache.h"
 #include "cache_intern.h"
+#include "bloom.h"
 #include <glib.h>
+#include <glib/gstdio.h>
+
+/////////////////////////////////
+/////////////////////////////////
+/////////////////////////////////
+
+gint64 db_url_hash (const gchar * url)
+{
+    guint64 hash = 0;
+    if (url != NULL)
+    {
+        hash = G_GUINT64_CONSTANT (0xcbf29ce484222325);
+        for (const guchar * c = (const guchar *) url; *c; c++)
+        {
+            hash ^= *c;
+            hash *= G_GUINT64_CONSTANT (0x100000001b3);
+        }
+    }
+    return (gint64) hash;
+}
+
+/////////////////////////////////
+/////////////////////////////////
+/////////////////////////////////
+
+void db_remember (GlyrDatabase * db, GlyrMemCache * cache)
+{
+    if (db && cache)
+    {
+        bloom_add (db->known_items,cache->md5sum,sizeof cache->md5sum);
+        if (cache->dsrc != NULL)
+        {
+            gint64 url_hash = db_url_hash (cache->dsrc);
+            bloom_add (db->known_items,&url_hash,sizeof url_hash);
+        }
+    }
+}
+
+/////////////////////////////////
+/////////////////////////////////
+/////////////////////////////////
+
+/* <root_path>/blobs/ab/abcdef... - the first two digits spread the files over 256 dirs */
+static gchar * blob_path (GlyrDatabase * db, const gchar * key)
+{
+    gchar shard[3] = {key[0], key[1], 0};
+    return g_build_filename (db->root_path,DB_BLOB_DIR,shard,key,NULL);
+}
+
+/////////////////////////////////
+
+gchar * db_blob_put (GlyrDatabase * db, const gchar * data, gsize size)
+{
+    gchar * key = g_compute_checksum_for_data (G_CHECKSUM_MD5, (const guchar *) data,size);
+    gchar * path = blob_path (db,key);
+
+    /* Same name, same content - nothing to write */
+    if (g_file_test (path,G_FILE_TEST_EXISTS) == FALSE)
+    {
+        gchar * dir = g_path_get_dirname (path);
+        GError * error = NULL;
+
+        g_mkdir_with_parents (dir,0755);
+        if (g_file_set_contents (path,data,size,&error) == FALSE)
+        {
+            glyr_message (-1,NULL,"db_blob_put: %s\n",error->message);
+            g_error_free (error);
+            g_free (key);
+            key = NULL;
+        }
+        g_free (dir);
+    }
+
+    g_free (path);
+    return key;
+}
+
+/////////////////////////////////
+
+gchar * db_blob_get (GlyrDatabase * db, const gchar * key, gsize * size)
+{
+    gchar * data = NULL;
+    gchar * path = blob_path (db,key);
+    GError * error = NULL;
+
+    if (g_file_get_contents (path,&data,size,&error) == FALSE)
+    {
+        glyr_message (-1,NULL,"db_blob_get: %s\n",error->message);
+        g_error_free (error);
+        data = NULL;
+    }
+
+    g_free (path);
+    return data;
+}
+
+/////////////////////////////////
+
+void db_blob_release (GlyrDatabase * db, const gchar * key)
+{
+    sqlite3_stmt * stmt = db_statement_acquire (db,DB_STMT_BLOB_USED);
+    sqlite3_bind_text (stmt,1,key,-1,SQLITE_STATIC);
+
+    if (sqlite3_step (stmt) == SQLITE_ROW && sqlite3_column_int (stmt,0) == 0)
+    {
+        gchar * path = blob_path (db,key);
+        g_unlink (path);
+        g_free (path);
+    }
+    db_statement_release (db,stmt);
+}
+
+/////////////////////////////////
+
+void db_blob_release_deleted (GlyrDatabase * db)
+{
+    GSList * keys = NULL;
+
+    sqlite3_stmt * stmt = db_statement_acquire (db,DB_STMT_RELEASED_BLOBS);
+    while (stmt != NULL && sqlite3_step (stmt) == SQLITE_ROW)
+    {
+        keys = g_slist_prepend (keys,g_strdup ( (const gchar *) sqlite3_column_text (stmt,0) ) );
+    }
+    db_statement_release (db,stmt);
+
+    if (keys != NULL)
+    {
+        for (GSList * elem = keys; elem; elem = elem->next)
+        {
+            db_blob_release (db,elem->data);
+        }
+        g_slist_free_full (keys,g_free);
+
+        stmt = db_statement_acquire (db,DB_STMT_FORGET_RELEASED);
+        if (stmt != NULL)
+        {
+            sqlite3_step (stmt);
+        }
+        db_statement_release (db,stmt);
+    }
+}
 
 /////////////////////////////////
 /////////////////////////////////
@@ -33,35 +175,41 @@ gboolean db_contains (GlyrDatabase * db, GlyrMemCache * cache)
     gboolean result = FALSE;
     if (db && cache)
     {
-        gchar * sql = sqlite3_mprintf (
-                          "SELECT source_url,data_checksum,data_size,data_type FROM metadata AS m      "
-                          "WHERE (m.data_type = %d AND m.data_size = %d AND m.data_checksum = '?')     "
-                          "OR (m.source_url LIKE '%q' AND m.source_url IS NOT NULL AND data_type = %d) "
-                          "LIMIT 1;                                                                    ",
-                          cache->type,
-                          cache->size,
-                          cache->dsrc,
-                          cache->type);
-
-        if (sql != NULL)
+        gint64 url_hash = db_url_hash (cache->dsrc);
+
+        /* Most items are new - the filter knows that without asking SQLite */
+        if (bloom_maybe_contains (db->known_items,cache->md5sum,sizeof cache->md5sum) == FALSE &&
+           (cache->dsrc == NULL || bloom_maybe_contains (db->known_items,&url_hash,sizeof url_hash) == FALSE) )
+        {
+            return FALSE;
+        }
+
+        DBReader * reader = db_reader_acquire (db);
+        sqlite3_stmt * stmt = db_reader_statement (reader,DB_STMT_CONTAINS);
+        if (stmt != NULL)
         {
-            sqlite3_stmt * stmt = NULL;
-            sqlite3_prepare_v2 (db->db_handle, sql, strlen (sql) + 1, &stmt, NULL);
-            sqlite3_bind_blob (stmt, 1, cache->md5sum, sizeof cache->md5sum, SQLITE_TRANSIENT);
+            sqlite3_bind_int (stmt, 1, cache->type);
+            sqlite3_bind_int (stmt, 2, cache->size);
+            sqlite3_bind_blob (stmt, 3, cache->md5sum, sizeof cache->md5sum, SQLITE_STATIC);
+
+            if (cache->dsrc != NULL)
+            {
+                /* source_url is stored with its terminating 0 */
+                sqlite3_bind_int64 (stmt, 4, url_hash);
+                sqlite3_bind_text (stmt, 5, cache->dsrc, strlen (cache->dsrc) + 1, SQLITE_STATIC);
+            }
 
             int err = sqlite3_step (stmt);
             if (err == SQLITE_ROW)
             {
-                result = TRUE;
+                result = sqlite3_column_int (stmt,0);
             }
             else if (err != SQLITE_DONE)
             {
-                glyr_message (-1,NULL,"db_contains: error message: %s\n", sqlite3_errmsg (db->db_handle) );
+                glyr_message (-1,NULL,"db_contains: error message: %s\n", sqlite3_errmsg (sqlite3_db_handle (stmt) ) );
             }
-
-            sqlite3_finalize (stmt);
-            sqlite3_free (sql);
         }
+        db_reader_release (db,reader,stmt);
     }
     return result;
 }
@@ -25,7 +25,110 @@
 #include "core.h"
 #include <glib.h>
 
+/* Statements compiled once in glyr_db_init() and reused for every call */
+typedef enum
+{
+    DB_STMT_BEGIN,
+    DB_STMT_COMMIT,
+    DB_STMT_ROLLBACK,
+    DB_STMT_INSERT_ARTIST,
+    DB_STMT_INSERT_ALBUM,
+    DB_STMT_INSERT_TITLE,
+    DB_STMT_INSERT_PROVIDER,
+    DB_STMT_INSERT_CACHE,
+    DB_STMT_DELETE_CHECKSUM,
+    DB_STMT_BLOB_USED,
+    DB_STMT_NEAR_ARTIST,
+    DB_STMT_NEAR_ALBUM,
+    DB_STMT_NEAR_TITLE,
+    DB_STMT_RELEASED_BLOBS,
+    DB_STMT_FORGET_RELEASED,
+    DB_STMT_TOUCH,
+    DB_STMT_EXPIRE,
+    DB_STMT_EVICT,
+    DB_STMT_BLOB_BYTES,
+    DB_STMT_RELEASED_BYTES,
+    DB_STMT_PAGE_SIZE,
+    DB_STMT_PAGE_COUNT,
+    DB_STMT_FREELIST_COUNT,
+    DB_STMT_VACUUM,
+    DB_STMT_EXPIRE_MISSES,
+    DB_STMT_RECENT_MISSES,
+    DB_STMT_INSERT_MISS,
+    DB_STMT_FORGET_MISS,
+    DB_STMT_CONTAINS,
+    DB_STMT_LAST
+
+} DBStatement;
+
+/* Lock the statements of db and return the one for id (NULL if it failed to compile).
+ * Every acquire needs a release, which also resets the statement and its bindings.
+ * The lock is recursive, so a thread may hold several statements at once.
+ */
+sqlite3_stmt * db_statement_acquire (GlyrDatabase * db, DBStatement id);
+void db_statement_release (GlyrDatabase * db, sqlite3_stmt * stmt);
+
+/* A read-only connection of a GlyrDatabase */
+typedef struct _DBReader DBReader;
+
+/* Take a reader of db, so lookups of several threads run in parallel (WAL mode).
+ * Readers only see committed data, so the thread inside a glyr_db_batch_begin()
+ * gets the writing connection instead. Every acquire needs a release.
+ */
+DBReader * db_reader_acquire (GlyrDatabase * db);
+
+/* The statement for id on reader's connection, NULL if it failed to compile */
+sqlite3_stmt * db_reader_statement (DBReader * reader, DBStatement id);
+
+/* Give reader back; stmt is reset if not NULL */
+void db_reader_release (GlyrDatabase * db, DBReader * reader, sqlite3_stmt * stmt);
+
+/* Hash of a source_url as stored in metadata.source_hash (64 bit FNV-1a).
+ * It's stored, so it must not depend on the host - 0 for NULL.
+ */
+gint64 db_url_hash (const gchar * url);
+
+/* Data of at least this size is stored as file under <root_path>/blobs/,
+ * named after its md5sum (and therefore stored once), the db only keeps the name
+ */
+#define DB_BLOB_MIN_SIZE (16 * 1024)
+#define DB_BLOB_DIR "blobs"
+
+/* Store data in the blob dir of db, returns its key (a hex md5sum) or NULL on failure */
+gchar * db_blob_put (GlyrDatabase * db, const gchar * data, gsize size);
+
+/* Read the blob stored under key, NULL if it is missing */
+gchar * db_blob_get (GlyrDatabase * db, const gchar * key, gsize * size);
+
+/* Remove the blob of key if no row refers to it anymore.
+ * Call it with the db lock held, or a concurrent insert might lose its blob.
+ */
+void db_blob_release (GlyrDatabase * db, const gchar * key);
+
+/* Release the blobs of all rows deleted since the last call.
+ * A temporary trigger of the writing connection collects them, so any DELETE works.
+ * glyr_db_batch_end() calls it after the outermost COMMIT succeeded; before that,
+ * readers still see the rows, and a failed COMMIT rolls the list back with them.
+ */
+void db_blob_release_deleted (GlyrDatabase * db);
+
+/* Tell the in-memory filter of db_contains() about cache */
+void db_remember (GlyrDatabase * db, GlyrMemCache * cache);
+
 /* Check if a file is contained in the db */
 gboolean db_contains (GlyrDatabase * db, GlyrMemCache * cache);
 
+/* The glyr_db_set_miss_ttl() of db, 0 if negative caching is off */
+gdouble db_miss_ttl (GlyrDatabase * db);
+
+/* Names of the providers that had nothing for the type, artist, album and title of query
+ * within glyr_db_set_miss_ttl(), as a set of strings; NULL if there are none.
+ */
+GHashTable * db_miss_lookup (GlyrDatabase * db, GlyrQuery * query);
+
+/* Remember that provider had nothing for query (only if negative caching is on),
+ * or forget it again if it found something
+ */
+void db_miss_update (GlyrDatabase * db, GlyrQuery * query, const gchar * provider, gboolean found);
+
 #endif
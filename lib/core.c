@@ -29,10 +29,18 @@
 
 /* Get access to the db */
 #include "cache_intern.h"
+#include "cache.h"
 
 /* Mini blacklist */
 #include "blacklist.h"
 
+/* Learned parallelism and timeouts */
+#include "autotune.h"
+
+/* Fast hashing for duplicate checks */
+#include "hash.h"
+#include "imghash.h"
+
 /* Somehow needed to prevent some compiler warning.. */
 #include <glib/gprintf.h>
 
@@ -144,13 +152,14 @@ void DL_set_data (GlyrMemCache * cache, const gchar * data, gint len)
         if (data != NULL)
         {
             cache->size = (len >= 0) ? (gsize) len : strlen (data);
-            update_md5sum (cache);
         }
         else
         {
             cache->size = 0;
-            memset (cache->md5sum,0,16);
         }
+
+        /* Stale now; built again only for items handed out or stored */
+        memset (cache->md5sum,0,16);
     }
 }
 
@@ -227,6 +236,7 @@ GlyrMemCache* DL_init (void)
     cache->duration = 0;
     cache->rating = 0;
     cache->timestamp = 0.0;
+    cache->score = 0.0;
     return cache;
 }
 
@@ -461,6 +471,93 @@ static struct header_data * retrieve_content_info (gchar * url, gchar * proxystr
     return info;
 }
 
+//////////////////////////////////////
+// DNS lookups and TLS sessions, shared by all transfers.
+// Connections are kept by the multi handle of each thread,
+// as libcurl's connection cache may not be used by several threads at once.
+//////////////////////////////////////
+
+static CURLSH * share_pool = NULL;
+static GMutex share_locks[CURL_LOCK_DATA_LAST];
+
+static void share_lock (CURL * handle, curl_lock_data data, curl_lock_access access, void * userptr)
+{
+    g_mutex_lock (&share_locks[data]);
+}
+
+static void share_unlock (CURL * handle, curl_lock_data data, void * userptr)
+{
+    g_mutex_unlock (&share_locks[data]);
+}
+
+static void free_thread_multi (gpointer multi)
+{
+    curl_multi_cleanup ( (CURLM *) multi);
+}
+
+static GPrivate thread_multi = G_PRIVATE_INIT (free_thread_multi);
+
+//////////////////////////////////////
+
+void share_pool_init (void)
+{
+    if (share_pool == NULL)
+    {
+        share_pool = curl_share_init();
+        if (share_pool != NULL)
+        {
+            curl_share_setopt (share_pool,CURLSHOPT_LOCKFUNC,share_lock);
+            curl_share_setopt (share_pool,CURLSHOPT_UNLOCKFUNC,share_unlock);
+            curl_share_setopt (share_pool,CURLSHOPT_SHARE,CURL_LOCK_DATA_DNS);
+            curl_share_setopt (share_pool,CURLSHOPT_SHARE,CURL_LOCK_DATA_SSL_SESSION);
+        }
+    }
+}
+
+//////////////////////////////////////
+
+void share_pool_cleanup (void)
+{
+    /* The ones of other threads go with them */
+    g_private_replace (&thread_multi,NULL);
+
+    if (share_pool != NULL)
+    {
+        curl_share_cleanup (share_pool);
+        share_pool = NULL;
+    }
+}
+
+//////////////////////////////////////
+
+/* The multi handle of this thread, with the connections its last downloads left open.
+ * A nested async_download() gets a new one.
+ */
+static CURLM * multi_acquire (void)
+{
+    CURLM * multi = g_private_get (&thread_multi);
+    if (multi != NULL)
+    {
+        g_private_set (&thread_multi,NULL);
+        return multi;
+    }
+    return curl_multi_init();
+}
+
+//////////////////////////////////////
+
+static void multi_release (CURLM * multi)
+{
+    if (g_private_get (&thread_multi) == NULL)
+    {
+        g_private_set (&thread_multi,multi);
+    }
+    else
+    {
+        curl_multi_cleanup (multi);
+    }
+}
+
 //////////////////////////////////////
 
 // Init an easyhandler with all relevant options
@@ -506,6 +603,12 @@ static DLBufferContainer * DL_setopt (CURL *eh, GlyrMemCache * cache, const char
     // (because I have it already of course! ;-))
     curl_easy_setopt (eh, CURLOPT_COOKIEJAR ,"");
 
+    // Reuse DNS lookups and TLS sessions of earlier transfers, even of other queries
+    if (share_pool != NULL)
+    {
+        curl_easy_setopt (eh, CURLOPT_SHARE, share_pool);
+    }
+
     return dlbuffer;
 }
 
@@ -521,11 +624,9 @@ gboolean continue_search (gint current, GlyrQuery * s)
          * alternatively we might hit the maximum for one plugin (off by one!)          */
         gint buffering = (s->imagejob) ? s->number / 3 : 0;
 
-        /* If we use caching we should consider getting a lot more items,
-         * since many of the *may* be already in the Database
-         */
-        gint pre_cache = (s->local_db) ? s->number : 0;
-        decision = (current + s->itemctr) < (s->number + buffering + pre_cache) &&
+        /* Items already in the local db were counted before going online,
+         * so there's no need to fetch more than the remainder here */
+        decision = (current + GET_ATOMIC_ITEMCTR (s) ) < (s->number + buffering) &&
                    (current < s->plugmax || (s->plugmax == -1) );
 
     }
@@ -536,64 +637,337 @@ gboolean continue_search (gint current, GlyrQuery * s)
 // Bad data checker mehods:
 //////////////////////////////////////
 
-/* Check for dupes. This does not affect the HEAD of the list, therefore no GList return */
-gsize delete_dupes (GList * result, GlyrQuery * s)
+static guint content_hash_hash (gconstpointer key)
 {
-    if (!result || g_list_length (result) < 1)
-        return 0;
+    /* The hash is evenly distributed already */
+    guint hash = 0;
+    memcpy (&hash,key,sizeof (guint) );
+    return hash;
+}
+
+static gboolean content_hash_equal (gconstpointer a, gconstpointer b)
+{
+    return memcmp (a,b,CONTENT_HASH_SIZE) == 0;
+}
+
+static gpointer content_hash_of (GlyrMemCache * cache, guchar * buf)
+{
+    content_hash (cache->data,(cache->data) ? cache->size : 0,buf);
+    return buf;
+}
+
+//////////////////////////////////////
+
+static void run_state_init (GlyrQuery * s)
+{
+    RunState * state = g_malloc0 (sizeof (RunState) );
+    state->parsed  = g_hash_table_new_full (content_hash_hash,content_hash_equal,g_free,NULL);
+    state->results = g_hash_table_new_full (content_hash_hash,content_hash_equal,g_free,NULL);
+    state->answered = g_hash_table_new (g_str_hash,g_str_equal);
+    s->run_state = state;
+}
+
+//////////////////////////////////////
 
-    /* Build new hashes, the data might have changed */
-    for (GList * elem = result; elem; elem = elem->next)
+static void run_state_free (GlyrQuery * s)
+{
+    RunState * state = s->run_state;
+    if (state != NULL)
     {
-        update_md5sum (elem->data);
+        g_hash_table_destroy (state->parsed);
+        g_hash_table_destroy (state->results);
+        g_hash_table_destroy (state->answered);
+        image_set_free (s);
+        if (state->texts != NULL)
+        {
+            g_array_free (state->texts,TRUE);
+        }
+        for (GList * elem = state->reserve; elem; elem = elem->next)
+        {
+            DL_free (elem->data);
+        }
+        g_list_free (state->reserve);
+        g_list_free (state->superseded);
+        if (state->variants != NULL)
+        {
+            g_hash_table_destroy (state->variants);
+        }
+        g_free (state);
+        s->run_state = NULL;
     }
+}
+
+//////////////////////////////////////
 
-    gint double_items = 0;
-    for (GList * inode = result; inode; inode = inode->next)
+/* Remember cache as result, FALSE if an item with the same content is already there */
+gboolean result_set_add (GlyrQuery * s, GlyrMemCache * cache)
+{
+    RunState * state = s->run_state;
+    if (state == NULL || cache == NULL)
     {
-        GlyrMemCache * lval = inode->data;
+        return TRUE;
+    }
 
-        GList * jnode = result;
-        while (jnode != NULL)
+    guchar hash[CONTENT_HASH_SIZE];
+    if (g_hash_table_lookup_extended (state->results,content_hash_of (cache,hash),NULL,NULL) == TRUE)
+    {
+        return FALSE;
+    }
+
+    g_hash_table_insert (state->results,g_memdup (hash,CONTENT_HASH_SIZE),NULL);
+    return TRUE;
+}
+
+//////////////////////////////////////
+
+/* Lyrics, bios etc. from different providers often differ only in whitespace, case or markup.
+ * Returns TRUE if item is such a copy of a text parsed before, otherwise remembers it.
+ */
+static gboolean text_set_merge (GlyrQuery * s, GlyrMemCache * item)
+{
+    RunState * state = s->run_state;
+    if (state == NULL || item->data == NULL || TYPE_IS_PROSE (item->type) == FALSE)
+    {
+        return FALSE;
+    }
+
+    /* Too short to tell a copy from a different text */
+    guint32 signature[MINHASH_SIZE];
+    if (minhash_text (item->data,item->size,signature) == FALSE)
+    {
+        return FALSE;
+    }
+
+    if (state->texts == NULL)
+    {
+        state->texts = g_array_new (FALSE,FALSE,sizeof (signature) );
+    }
+
+    for (guint i = 0; i < state->texts->len; i++)
+    {
+        const guint32 * other = (const guint32 *) (state->texts->data + i * sizeof (signature) );
+        if (minhash_similarity (signature,other) >= TEXT_MAX_SIMILARITY)
         {
-            bool is_duplicate  = false;
-            GlyrMemCache * rval = jnode->data;
+            return TRUE;
+        }
+    }
 
-            if (lval && rval && rval != lval && lval->size == rval->size)
-            {
-                /* Compare via checkums */
-                if (CALC_MD5SUMS == false)
-                {
-                    if (!memcmp (lval->data,rval->data,rval->size) )
-                    {
-                        is_duplicate = true;
-                    }
-                }
-                else
-                {
-                    if (!memcmp (lval->md5sum,rval->md5sum,16) )
-                    {
-                        is_duplicate = true;
-                    }
-                }
+    g_array_append_vals (state->texts,signature,1);
+    return FALSE;
+}
 
-                /* Delete this element.. */
-                if (is_duplicate == true)
-                {
-                    DL_free (rval);
+//////////////////////////////////////
 
-                    /* Delete this ref from the list */
-                    GList * to_free = jnode;
-                    jnode = jnode->next;
-                    result = g_list_delete_link (result,to_free);
+/* Best levenshtein_strnormcmp() distance seen by the parser running in this thread.
+ * Stored as distance + 1, so NULL means that the parser did not compare anything.
+ */
+static GPrivate parse_distance = G_PRIVATE_INIT (NULL);
 
-                    /* Remember him.. */
-                    double_items++;
-                    continue;
-                }
+void record_match_distance (gsize distance)
+{
+    gsize stored = GPOINTER_TO_SIZE (g_private_get (&parse_distance) );
+    if (stored == 0 || distance + 1 < stored)
+    {
+        g_private_set (&parse_distance,GSIZE_TO_POINTER (distance + 1) );
+    }
+}
+
+//////////////////////////////////////
+
+/* Confidence in an item, from 0.0 to 1.0:
+ * Half of it is the quality of the provider, half how well the best compared string matched.
+ * distance is in the format of parse_distance; if unknown, the match counts as average.
+ */
+static float score_item (GlyrQuery * s, gint quality, gsize distance)
+{
+    gfloat provider = CLAMP (quality,0,100) / 100.0;
+    gfloat match = 0.5;
+    if (distance > 0)
+    {
+        match = CLAMP (1.0 - (distance - 1) / (s->fuzzyness + 1.0),0.0,1.0);
+    }
+    return (provider + match) / 2;
+}
+
+//////////////////////////////////////
+
+float score_image (float url_score, gsize size)
+{
+    gfloat size_score = MIN (size / (gfloat) SCORE_IMAGE_FULL_SIZE,1.0);
+    return url_score * (1.0 - SCORE_IMAGE_SIZE_WEIGHT) + size_score * SCORE_IMAGE_SIZE_WEIGHT;
+}
+
+//////////////////////////////////////
+
+/* Score of an image URL, with the size its URL tells about */
+static float score_image_url (float url_score, const gchar * url)
+{
+    gint edge = guess_image_size (url);
+    if (edge > 0)
+    {
+        gfloat edge_score = MIN (edge / (gfloat) SCORE_IMAGE_FULL_EDGE,1.0);
+        url_score = url_score * (1.0 - SCORE_IMAGE_HINT_WEIGHT) + edge_score * SCORE_IMAGE_HINT_WEIGHT;
+    }
+    return url_score;
+}
+
+//////////////////////////////////////
+
+/* Returns TRUE if item (or any item before) is good enough to stop the search, item may be NULL.
+ * Only pass items that were accepted - downloaded and finalized - as a rejected one must not stop anything.
+ */
+static gboolean score_is_confident (GlyrQuery * s, GlyrMemCache * item)
+{
+    RunState * state = s->run_state;
+    if (state != NULL && item != NULL && s->confidence > 0.0 && item->score >= s->confidence)
+    {
+        state->confident = TRUE;
+    }
+    return (state != NULL) ? state->confident : FALSE;
+}
+
+//////////////////////////////////////
+
+/* Near duplicate check of an image that is about to be accepted, see image_set_merge().
+ * Returns FALSE if image should be dropped. If image is a larger copy of an image accepted before,
+ * that one is dropped from the results instead, by drop_superseded_images().
+ */
+static gboolean image_set_admit (GlyrQuery * s, GlyrMemCache * image)
+{
+    GlyrMemCache * smaller = NULL;
+    if (image_set_merge (s,image,&smaller) == TRUE)
+    {
+        return FALSE;
+    }
+
+    if (smaller != NULL)
+    {
+        RunState * state = s->run_state;
+        state->superseded = g_list_prepend (state->superseded,smaller);
+        ADD_ATOMIC_ITEMCTR (s,-1);
+    }
+    return TRUE;
+}
+
+//////////////////////////////////////
+
+/* Remove the images replaced by a larger copy from list, and free them */
+static void drop_superseded_images (GlyrQuery * s, GList ** list)
+{
+    RunState * state = s->run_state;
+    GList * elem = (state != NULL) ? state->superseded : NULL;
+    while (elem != NULL)
+    {
+        GList * next = elem->next;
+        GList * link = g_list_find (*list,elem->data);
+        if (link != NULL)
+        {
+            *list = g_list_delete_link (*list,link);
+            DL_free (elem->data);
+            state->superseded = g_list_delete_link (state->superseded,elem);
+        }
+        elem = next;
+    }
+}
+
+//////////////////////////////////////
+
+gboolean accept_image (GlyrQuery * s, GlyrMemCache * image, GlyrMemCache * origin, GLYR_DATA_TYPE type, bool * stop_download)
+{
+    gboolean accepted = FALSE;
+    GLYR_ERROR response = GLYRE_OK;
+
+    image->is_image = true;
+    image->score = score_image (origin->score,image->size);
+    image->prov       = (origin->prov != NULL) ? g_strdup (origin->prov) : NULL;
+    image->img_format = (origin->img_format != NULL) ? g_strdup (origin->img_format) : NULL;
+
+    if (image->type == GLYR_TYPE_UNKNOWN)
+    {
+        image->type = type;
+    }
+
+    if (result_set_add (s,image) == TRUE && image_set_admit (s,image) == TRUE)
+    {
+        /* Only needed for items handed out */
+        update_md5sum (image);
+
+        if (s->callback.download != NULL)
+        {
+            response = s->callback.download (image,s);
+        }
+
+        accepted = (response != GLYRE_SKIP && response != GLYRE_STOP_PRE);
+        if (accepted == FALSE)
+        {
+            image_set_forget (s,image);
+        }
+        else if (score_is_confident (s,image) == TRUE)
+        {
+            /* Good enough - other images need not be downloaded */
+            glyr_message (2,s,"#[%02d/%02d] %s delivered a confident image (%.2f)\n",s->itemctr,s->number,image->prov ? image->prov : "?",image->score);
+            *stop_download = TRUE;
+        }
+    }
+    else
+    {
+        ADD_ATOMIC_ITEMCTR (s,-1);
+    }
+
+    if (response == GLYRE_STOP_POST || response == GLYRE_STOP_PRE)
+    {
+        *stop_download = TRUE;
+    }
+    return accepted;
+}
+
+//////////////////////////////////////
+
+/* Sort callback, best score first */
+static gint compare_score (gconstpointer a, gconstpointer b)
+{
+    gfloat score_a = ( (GlyrMemCache *) a)->score;
+    gfloat score_b = ( (GlyrMemCache *) b)->score;
+    return (score_a < score_b) - (score_a > score_b);
+}
+
+//////////////////////////////////////
+
+/* Check for dupes against everything parsed in this run so far.
+ * The first item with some content wins, later ones are freed and removed from *result.
+ * If the data of an item changed since the last check, both versions are remembered.
+ */
+static gsize delete_dupes (GList ** result, GlyrQuery * s)
+{
+    RunState * state = s->run_state;
+    if (state == NULL || result == NULL)
+    {
+        return 0;
+    }
+
+    gsize double_items = 0;
+    GList * elem = *result;
+    while (elem != NULL)
+    {
+        GList * next = elem->next;
+        GlyrMemCache * item = elem->data;
+        if (item != NULL)
+        {
+            /* Build a new hash, the data might have changed */
+            guchar hash[CONTENT_HASH_SIZE];
+            GlyrMemCache * first = g_hash_table_lookup (state->parsed,content_hash_of (item,hash) );
+            if (first == NULL)
+            {
+                g_hash_table_insert (state->parsed,g_memdup (hash,CONTENT_HASH_SIZE),item);
+            }
+            else if (first != item)
+            {
+                DL_free (item);
+                *result = g_list_delete_link (*result,elem);
+                double_items++;
             }
-            jnode = jnode->next;
         }
+        elem = next;
     }
 
     return double_items;
@@ -601,6 +975,18 @@ gsize delete_dupes (GList * result, GlyrQuery * s)
 
 //////////////////////////////////////
 
+/* Timeout of a single transfer of url in seconds, learned if the query wants it */
+static long transfer_timeout (GlyrQuery * s, const gchar * url, long fallback)
+{
+    if (s != NULL && s->autotune == TRUE)
+    {
+        return autotune_timeout (s->type,url,fallback);
+    }
+    return fallback;
+}
+
+//////////////////////////////////////
+
 // Download a singe file NOT in parallel
 GlyrMemCache * download_single (const char* url, GlyrQuery * s, const char * end)
 {
@@ -624,7 +1010,7 @@ GlyrMemCache * download_single (const char* url, GlyrQuery * s, const char * end
         if (curl != NULL)
         {
             /* Configure curl */
-            DLBufferContainer * dlbuffer = DL_setopt (curl,dldata,url,s,NULL, (s) ? s->timeout : 5, NULL);
+            DLBufferContainer * dlbuffer = DL_setopt (curl,dldata,url,s,NULL, (s) ? transfer_timeout (s,url,s->timeout) : 5, NULL);
 
             /* Perform transaction */
             res = curl_easy_perform (curl);
@@ -651,7 +1037,6 @@ GlyrMemCache * download_single (const char* url, GlyrQuery * s, const char * end
             }
 
             curl_easy_cleanup (curl);
-            update_md5sum (dldata);
             return dldata;
         }
         DL_free (dldata);
@@ -662,7 +1047,7 @@ GlyrMemCache * download_single (const char* url, GlyrQuery * s, const char * end
 //////////////////////////////////////
 
 // Init a callback object and a curl_easy_handle
-static GlyrMemCache * init_async_cache (CURLM * cm, cb_object * capo, GlyrQuery *s, long timeout, gchar * endmark)
+static GlyrMemCache * init_async_cache (cb_object * capo, GlyrQuery *s, long timeout, gchar * endmark)
 {
     GlyrMemCache * dlcache = NULL;
     if (capo && capo->url)
@@ -679,22 +1064,24 @@ static GlyrMemCache * init_async_cache (CURLM * cm, cb_object * capo, GlyrQuery
         /* Make sure this is null at start */
         capo->dlbuffer = NULL;
 
-        /* Configure this handle */
-        capo->dlbuffer = DL_setopt (eh, dlcache, capo->url, s, (void*) capo,timeout, endmark);
+        /* Learned per provider, remembered to tell a timeout apart later */
+        capo->timeout = transfer_timeout (s,capo->url,timeout);
 
-        /* Add handle to multihandle */
-        curl_multi_add_handle (cm, eh);
+        /* Configure this handle */
+        capo->dlbuffer = DL_setopt (eh, dlcache, capo->url, s, (void*) capo,capo->timeout, endmark);
 
         /* This is set to true once DL_buffer is reached */
         capo->was_buffered = FALSE;
 
+        /* Handle is added to the multihandle once it gets a transfer slot */
+        capo->has_slot = FALSE;
     }
     return dlcache;
 }
 
 //////////////////////////////////////
 
-static GList * init_async_download (GList * url_list, GList * endmark_list, CURLM * cmHandle, GlyrQuery * s, int abs_timeout)
+static GList * init_async_download (GList * url_list, GList * endmark_list, GlyrQuery * s, int abs_timeout)
 {
     GList * cb_list = NULL;
     for (GList * elem = url_list; elem; elem = elem->next)
@@ -711,19 +1098,200 @@ static GList * init_async_download (GList * url_list, GList * endmark_list, CURL
             gint endmark_pos = g_list_position (url_list,elem);
             GList * glist_m  = g_list_nth (endmark_list,endmark_pos);
             gchar * endmark  = (glist_m==NULL) ? NULL : glist_m->data;
-            obj->cache = init_async_cache (cmHandle,obj,s,abs_timeout,endmark);
+            obj->cache = init_async_cache (obj,s,abs_timeout,endmark);
         }
     }
     return cb_list;
 }
 
+//////////////////////////////////////
+// Transfer slots, shared by all queries
 //////////////////////////////////////
 
-static void destroy_async_download (GList * cb_list, CURLM * cmHandle, gboolean free_caches)
+static GMutex slot_lock;
+static GCond slot_cond;
+
+/* Slots in use, and transfers of interactive queries waiting for one */
+static gint slots_busy = 0;
+static gint slots_wanted = 0;
+
+/* Slots background transfers gave up for the waiting ones, not taken yet */
+static gint slots_yielded = 0;
+
+//////////////////////////////////////
+
+/* Try to get a slot for one transfer of this query, never blocks */
+static gboolean slot_try_acquire (GlyrQuery * s)
 {
-    /* Free ressources */
-    curl_multi_cleanup (cmHandle);
+    gboolean granted = FALSE;
+    g_mutex_lock (&slot_lock);
 
+    if (GET_ATOMIC_PRIORITY (s) == GLYR_PRIORITY_BACKGROUND)
+    {
+        granted = (slots_wanted == 0) &&
+                  (slots_busy < GLYR_TRANSFER_SLOTS - GLYR_TRANSFER_SLOTS_RESERVED);
+    }
+    else
+    {
+        granted = (slots_busy < GLYR_TRANSFER_SLOTS);
+        if (granted == TRUE)
+        {
+            slots_yielded = MAX (slots_yielded - 1, 0);
+        }
+    }
+
+    if (granted == TRUE)
+    {
+        slots_busy++;
+    }
+
+    g_mutex_unlock (&slot_lock);
+    return granted;
+}
+
+//////////////////////////////////////
+
+static void slot_release (void)
+{
+    g_mutex_lock (&slot_lock);
+    slots_busy = MAX (slots_busy - 1, 0);
+    g_cond_broadcast (&slot_cond);
+    g_mutex_unlock (&slot_lock);
+}
+
+//////////////////////////////////////
+
+/* Tell the others how many transfers of this download wait for a slot.
+ * announced holds what this download told last time.
+ */
+static void slot_announce_waiting (gint * announced, gint waiting)
+{
+    if (*announced != waiting)
+    {
+        g_mutex_lock (&slot_lock);
+        slots_wanted += waiting - *announced;
+        slots_yielded = MIN (slots_yielded,slots_wanted);
+        g_mutex_unlock (&slot_lock);
+        *announced = waiting;
+    }
+}
+
+//////////////////////////////////////
+
+/* How many of its available slots a background download should give up,
+ * so that no more are freed than interactive transfers wait for.
+ */
+static gint slot_preemption_claim (GlyrQuery * s, gint available)
+{
+    gint claimed = 0;
+    if (GET_ATOMIC_PRIORITY (s) == GLYR_PRIORITY_BACKGROUND && available > 0)
+    {
+        g_mutex_lock (&slot_lock);
+        claimed = CLAMP (slots_wanted - slots_yielded,0,available);
+        slots_yielded += claimed;
+        g_mutex_unlock (&slot_lock);
+    }
+    return claimed;
+}
+
+//////////////////////////////////////
+
+/* Sleep till somebody releases a slot, but at most timeout_ms */
+static void slot_wait (gint timeout_ms)
+{
+    g_mutex_lock (&slot_lock);
+    g_cond_wait_until (&slot_cond,&slot_lock,g_get_monotonic_time () + timeout_ms * G_TIME_SPAN_MILLISECOND);
+    g_mutex_unlock (&slot_lock);
+}
+
+//////////////////////////////////////
+
+/* Add as many pending transfers to the multihandle as we get slots for */
+static GList * start_pending_transfers (CURLM * cmHandle, GList * pending, GlyrQuery * s, gint * announced)
+{
+    while (pending != NULL && slot_try_acquire (s) == TRUE)
+    {
+        cb_object * capo = pending->data;
+        gint64 now = g_get_monotonic_time();
+        if (capo->deadline == 0)
+        {
+            capo->deadline = now + capo->timeout * G_TIME_SPAN_SECOND;
+        }
+        else
+        {
+            /* Preempted before - curl would start its timeout again */
+            long remaining_ms = (capo->deadline - now) / G_TIME_SPAN_MILLISECOND;
+            curl_easy_setopt (capo->handle,CURLOPT_TIMEOUT_MS,MAX (remaining_ms,1L) );
+        }
+
+        capo->has_slot = TRUE;
+        curl_multi_add_handle (cmHandle, capo->handle);
+        pending = g_list_delete_link (pending,pending);
+    }
+
+    gint waiting = 0;
+    if (GET_ATOMIC_PRIORITY (s) == GLYR_PRIORITY_INTERACTIVE)
+    {
+        waiting = g_list_length (pending);
+    }
+
+    slot_announce_waiting (announced,waiting);
+    return pending;
+}
+
+//////////////////////////////////////
+
+static gboolean is_preemptable (cb_object * capo)
+{
+    return (capo->has_slot && capo->handle && capo->cache && capo->cache->size == 0);
+}
+
+//////////////////////////////////////
+
+/* Give back the slots of transfers that did not receive a single byte yet,
+ * as many as interactive transfers wait for. They are restarted from scratch
+ * once they get a new slot, but keep their deadline.
+ */
+static GList * preempt_transfers (CURLM * cmHandle, GList * cb_list, GList * pending, GlyrQuery * s)
+{
+    if (GET_ATOMIC_PRIORITY (s) != GLYR_PRIORITY_BACKGROUND)
+    {
+        return pending;
+    }
+
+    gint available = 0;
+    for (GList * elem = cb_list; elem; elem = elem->next)
+    {
+        available += is_preemptable (elem->data);
+    }
+
+    gint claimed = slot_preemption_claim (s,available);
+    gint preempted = 0;
+    for (GList * elem = cb_list; elem && preempted < claimed; elem = elem->next)
+    {
+        cb_object * capo = elem->data;
+        if (is_preemptable (capo) )
+        {
+            curl_multi_remove_handle (cmHandle,capo->handle);
+            capo->has_slot = FALSE;
+            slot_release();
+
+            pending = g_list_append (pending,capo);
+            preempted++;
+        }
+    }
+
+    if (preempted > 0)
+    {
+        glyr_message (3,s,"- Preempted %d background transfer(s)\n",preempted);
+    }
+    return pending;
+}
+
+//////////////////////////////////////
+
+static void destroy_async_download (GList * cb_list, CURLM * cmHandle, gboolean free_caches)
+{
     if (cb_list != NULL)
     {
         for (GList * elem = cb_list; elem; elem = elem->next)
@@ -731,9 +1299,20 @@ static void destroy_async_download (GList * cb_list, CURLM * cmHandle, gboolean
             cb_object * item = elem->data;
             if (item->handle != NULL)
             {
+                /* Only transfers holding a slot were added to the multihandle */
+                if (item->has_slot == TRUE)
+                {
+                    curl_multi_remove_handle (cmHandle,item->handle);
+                }
                 curl_easy_cleanup (item->handle);
             }
 
+            if (item->has_slot == TRUE)
+            {
+                item->has_slot = FALSE;
+                slot_release();
+            }
+
             /* Also free unbuffered items, that don't appear in the queue,
              * even if free_caches was set to FALSE
              */
@@ -744,17 +1323,310 @@ static void destroy_async_download (GList * cb_list, CURLM * cmHandle, gboolean
                 item->cache = NULL;
             }
 
+            /* URL item of an image transfer */
+            DL_free (item->origin);
+
             g_free (item->dlbuffer);
             g_free (item->url);
         }
         glist_free_full (cb_list,g_free);
     }
+
+    /* Kept for the next download of this thread, with its open connections */
+    multi_release (cmHandle);
+}
+
+//////////////////////////////////////
+
+static GList * call_provider_callback (cb_object * capo, void * userptr, bool * stop_download, gint * to_add);
+
+//////////////////////////////////////
+
+/* Shared by the parse workers of one async_download() */
+typedef struct
+{
+    AsyncPrepareCB prepare;
+    void * userptr;
+
+    /* cb_objects whose items are prepared, merged by the downloading thread */
+    GAsyncQueue * done;
+
+    /* Set once nobody waits for the results anymore */
+    gint cancelled;
+
+} ParseContext;
+
+//////////////////////////////////////
+
+static void parse_worker (gpointer data, gpointer user_data)
+{
+    cb_object * capo = data;
+    ParseContext * context = user_data;
+
+    if (g_atomic_int_get (&context->cancelled) == FALSE && GET_ATOMIC_SIGNAL_EXIT (capo->s) == FALSE)
+    {
+        capo->prepared = context->prepare (capo,context->userptr);
+        capo->is_prepared = TRUE;
+    }
+    g_async_queue_push (context->done,capo);
+}
+
+//////////////////////////////////////
+
+/* Free a finished download nobody is interested in anymore */
+static void discard_prepared (cb_object * capo)
+{
+    for (GList * elem = capo->prepared; elem; elem = elem->next)
+    {
+        DL_free (elem->data);
+    }
+    g_list_free (capo->prepared);
+    capo->prepared = NULL;
+
+    DL_free (capo->cache);
+    capo->cache = NULL;
+    capo->consumed = TRUE;
+}
+
+//////////////////////////////////////
+
+/* Images downloaded by the same async_download() as the pages their URLs were found on */
+typedef struct
+{
+    /* New image transfers, not yet in the transfer lists */
+    GList * spawned;
+
+    /* Image transfers not finished yet */
+    gint open;
+
+    /* Set once no more pages are wanted; the images are still downloaded */
+    gboolean pages_stopped;
+    gboolean pages_dropped;
+
+} ImagePipeline;
+
+//////////////////////////////////////
+
+/* With glyr_opt_img_dedup() only the largest size of an image is downloaded, if its URL tells the size.
+ * Returns FALSE if url only differs in the size from one started before, and is not larger.
+ */
+static gboolean image_variant_wanted (GlyrQuery * s, const gchar * url)
+{
+    RunState * state = s->run_state;
+    gchar * variant = (state != NULL && s->img_dedup == TRUE) ? strip_image_size (url) : NULL;
+    if (variant == NULL)
+    {
+        return TRUE;
+    }
+
+    if (state->variants == NULL)
+    {
+        state->variants = g_hash_table_new_full (g_str_hash,g_str_equal,g_free,NULL);
+    }
+
+    gint size = guess_image_size (url);
+    if (size <= GPOINTER_TO_INT (g_hash_table_lookup (state->variants,variant) ) )
+    {
+        glyr_message (3,s,"- Not downloading %s, a larger size of it is downloaded already\n",url);
+        g_free (variant);
+        return FALSE;
+    }
+
+    g_hash_table_replace (state->variants,variant,GINT_TO_POINTER (size) );
+    return TRUE;
 }
 
 //////////////////////////////////////
-/* ----------------- THE HEART OF GOLD ------------------ */
+
+static void spawn_image_transfer (GlyrQuery * s, GlyrMemCache * origin, ImagePipeline * pipeline, long timeout)
+{
+    if (is_blacklisted (origin->data) == false && image_variant_wanted (s,origin->data) == TRUE)
+    {
+        cb_object * obj = g_malloc0 (sizeof (cb_object) );
+        obj->s = s;
+        obj->url = g_strdup (origin->data);
+        obj->origin = origin;
+        obj->cache = init_async_cache (obj,s,timeout,NULL);
+
+        pipeline->spawned = g_list_prepend (pipeline->spawned,obj);
+        pipeline->open++;
+    }
+    else
+    {
+        ADD_ATOMIC_ITEMCTR (s,-1);
+        DL_free (origin);
+    }
+}
+
 //////////////////////////////////////
-GList * async_download (GList * url_list, GList * endmark_list, GlyrQuery * s, long parallel_fac, long timeout_fac, AsyncDLCB asdl_callback, void * userptr, gboolean free_caches)
+
+static void spawn_image_transfers (cb_object * capo, ImagePipeline * pipeline, long timeout)
+{
+    for (GList * elem = capo->follow_ups; elem; elem = elem->next)
+    {
+        spawn_image_transfer (capo->s,elem->data,pipeline,timeout);
+    }
+    g_list_free (capo->follow_ups);
+    capo->follow_ups = NULL;
+}
+
+//////////////////////////////////////
+
+/* An image did not make it - try the best of the URLs held back instead */
+static void backfill_images (GlyrQuery * s, ImagePipeline * pipeline, long timeout)
+{
+    RunState * state = s->run_state;
+    while (state != NULL && state->reserve != NULL && s->itemctr < s->number)
+    {
+        GlyrMemCache * origin = state->reserve->data;
+        state->reserve = g_list_delete_link (state->reserve,state->reserve);
+
+        glyr_message (3,s,"- Back-filling with %s\n",origin->data);
+        ADD_ATOMIC_ITEMCTR (s,1);
+        spawn_image_transfer (s,origin,pipeline,timeout);
+    }
+}
+
+//////////////////////////////////////
+
+/* Stop all page transfers that are still running or waiting for a slot */
+static GList * drop_page_transfers (CURLM * cmHandle, GList * cb_list, GList * pending)
+{
+    for (GList * elem = cb_list; elem; elem = elem->next)
+    {
+        cb_object * capo = elem->data;
+        if (capo->origin == NULL && capo->handle != NULL)
+        {
+            if (capo->has_slot == TRUE)
+            {
+                curl_multi_remove_handle (cmHandle,capo->handle);
+                capo->has_slot = FALSE;
+                slot_release();
+            }
+
+            curl_easy_cleanup (capo->handle);
+            capo->handle = NULL;
+            pending = g_list_remove (pending,capo);
+        }
+    }
+    return pending;
+}
+
+//////////////////////////////////////
+
+/* Hand a finished download to the callback, and add what it made of it to item_list.
+ * Returns TRUE if anything was added.
+ */
+static gboolean collect_results (cb_object * capo, AsyncDLCB asdl_callback, void * userptr, GList ** item_list, gboolean * terminate, ImagePipeline * pipeline, long timeout)
+{
+    /* How many items from the callback will actually be added */
+    gint to_add = 0;
+
+    /* Stop download after this came in */
+    bool stop_download = false;
+    GList * cb_results = NULL;
+
+    if (capo->origin != NULL)
+    {
+        /* An image of the pipeline */
+        pipeline->open--;
+        if (accept_image (capo->s,capo->cache,capo->origin,capo->origin->type,&stop_download) == TRUE)
+        {
+            *item_list = g_list_prepend (*item_list,capo->cache);
+            capo->consumed = TRUE;
+            *terminate = stop_download;
+            return TRUE;
+        }
+
+        capo->consumed = TRUE;
+        DL_free (capo->cache);
+        capo->cache = NULL;
+        *terminate = stop_download;
+
+        backfill_images (capo->s,pipeline,timeout);
+        return FALSE;
+    }
+
+    if (pipeline->pages_stopped == TRUE)
+    {
+        /* Parsed, but not needed anymore */
+        discard_prepared (capo);
+        return FALSE;
+    }
+
+    /* Call it if present */
+    if (asdl_callback != NULL)
+    {
+        /* Add parsed results or nothing if parsed result is empty */
+        cb_results = asdl_callback (capo,userptr,&stop_download,&to_add);
+    }
+
+    if (cb_results != NULL)
+    {
+        /* Fill in the source filed (dsrc) if not already done */
+        for (GList * elem = cb_results; elem; elem = elem->next)
+        {
+            GlyrMemCache * item = elem->data;
+            if (item && item->dsrc == NULL)
+            {
+                /* Plugin didn't do any special download */
+                item->dsrc = g_strdup (capo->url);
+            }
+            *item_list = g_list_prepend (*item_list,item);
+        }
+        g_list_free (cb_results);
+    }
+    else if (to_add != 0)
+    {
+        /* Add it as raw data */
+        *item_list = g_list_prepend (*item_list,capo->cache);
+    }
+    else
+    {
+        capo->consumed = TRUE;
+        DL_free (capo->cache);
+        capo->cache = NULL;
+    }
+
+    /* Image URLs are downloaded right away, skipped ones leave room for others */
+    spawn_image_transfers (capo,pipeline,timeout);
+    backfill_images (capo->s,pipeline,timeout);
+
+    /* So, shall we stop? Not while images are still coming in */
+    if (stop_download == true && pipeline->open > 0)
+    {
+        pipeline->pages_stopped = TRUE;
+    }
+    else
+    {
+        *terminate = stop_download;
+    }
+    return (cb_results != NULL || to_add != 0);
+}
+
+//////////////////////////////////////
+
+/* Put newly spawned image transfers into the lists of async_download() */
+static GList * sync_image_pipeline (ImagePipeline * pipeline, CURLM * cmHandle, GList ** cb_list, GList * pending)
+{
+    if (pipeline->spawned != NULL)
+    {
+        *cb_list = g_list_concat (*cb_list,g_list_copy (pipeline->spawned) );
+        pending = g_list_concat (pending,pipeline->spawned);
+        pipeline->spawned = NULL;
+    }
+
+    if (pipeline->pages_stopped == TRUE && pipeline->pages_dropped == FALSE)
+    {
+        pending = drop_page_transfers (cmHandle,*cb_list,pending);
+        pipeline->pages_dropped = TRUE;
+    }
+    return pending;
+}
+
+//////////////////////////////////////
+
+GList * async_download (GList * url_list, GList * endmark_list, GlyrQuery * s, long parallel_fac, long timeout_fac, AsyncPrepareCB prepare, AsyncDLCB asdl_callback, void * userptr, gboolean free_caches)
 {
     /* Storage for result items */
     GList * item_list = NULL;
@@ -771,18 +1643,43 @@ GList * async_download (GList * url_list, GList * endmark_list, GlyrQuery * s, l
         fd_set ReadFDS, WriteFDS, ErrorFDS;
 
         /* Curl Multi Handles (~ container for easy handlers) */
-        CURLM   * cmHandle = curl_multi_init();
+        CURLM   * cmHandle = multi_acquire();
         curl_multi_setopt (cmHandle, CURLMOPT_MAXCONNECTS,abs_parallel);
         curl_multi_setopt (cmHandle, CURLMOPT_PIPELINING, 1L);
 
         /* Once set to true this will terminate the download */
         gboolean terminate = FALSE;
 
-        /* Now create cb_objects */
-        GList * cb_list = init_async_download (url_list,endmark_list,cmHandle,s,abs_timeout);
+        /* Now create cb_objects, they start once they got a transfer slot */
+        GList * cb_list = init_async_download (url_list,endmark_list,s,abs_timeout);
+        GList * pending = g_list_copy (cb_list);
+        gint waiting_announced = 0;
+
+        /* Observations for the autotuner, about the provider pages only - not the images they pointed to */
+        gint64 started_at = g_get_monotonic_time();
+        gdouble first_result = -1.0;
+        gint finished = 0, succeeded = 0;
+
+        /* Image transfers spawned by the callback */
+        ImagePipeline pipeline = {NULL, 0, FALSE, FALSE};
+
+        /* Parse in worker threads, so the transfers go on meanwhile */
+        ParseContext context = {prepare, userptr, NULL, FALSE};
+        GThreadPool * parse_pool = NULL;
+        gint parsing = 0;
+        if (prepare != NULL)
+        {
+            context.done = g_async_queue_new();
+            parse_pool = g_thread_pool_new (parse_worker,&context,MIN (g_get_num_processors(),GLYR_PARSE_THREADS),FALSE,NULL);
+        }
 
-        while (GET_ATOMIC_SIGNAL_EXIT (s) == FALSE && running_handles != 0 && terminate == FALSE)
+        while (GET_ATOMIC_SIGNAL_EXIT (s) == FALSE && terminate == FALSE && (running_handles != 0 || pending != NULL || parsing > 0) )
         {
+            /* Interactive queries are waiting - make room for them */
+            pending = preempt_transfers (cmHandle,cb_list,pending,s);
+
+            pending = start_pending_transfers (cmHandle,pending,s,&waiting_announced);
+
             CURLMcode merr = CURLM_CALL_MULTI_PERFORM;
             while (merr == CURLM_CALL_MULTI_PERFORM)
             {
@@ -791,7 +1688,7 @@ GList * async_download (GList * url_list, GList * endmark_list, GlyrQuery * s, l
             if (merr != CURLM_OK)
             {
                 glyr_message (1,s,"Error: curl_multi_perform() failed!");
-                return NULL;
+                break;
             }
 
             if (running_handles != 0)
@@ -805,7 +1702,7 @@ GList * async_download (GList * url_list, GList * endmark_list, GlyrQuery * s, l
                         curl_multi_timeout (cmHandle, &wait_time) )
                 {
                     glyr_message (1,s,"Error while selecting stream. Might be a bug.\n");
-                    return NULL;
+                    break;
                 }
 
                 if (wait_time == -1)
@@ -814,6 +1711,10 @@ GList * async_download (GList * url_list, GList * endmark_list, GlyrQuery * s, l
                 if (wait_time >= s->timeout * 1000)
                     wait_time = s->timeout * 1000;
 
+                /* Do not let finished parsers wait too long */
+                if (parsing > 0 && wait_time > 10)
+                    wait_time = 10;
+
                 /* Nothing happens.. */
                 if (max_fd == -1)
                 {
@@ -829,10 +1730,15 @@ GList * async_download (GList * url_list, GList * endmark_list, GlyrQuery * s, l
                     if (select (max_fd+1, &ReadFDS, &WriteFDS, &ErrorFDS, &Tmax) == -1)
                     {
                         glyr_message (1,s,"Error: select(%i <=> %li): %i: %s\n",max_fd+1, wait_time, errno, strerror (errno) );
-                        return NULL;
+                        break;
                     }
                 }
             }
+            else if (pending != NULL)
+            {
+                /* Everything we want to start waits for a free slot */
+                slot_wait (100);
+            }
 
 
             /* select() returned. There might be some fresh flesh! - Check. */
@@ -852,6 +1758,13 @@ GList * async_download (GList * url_list, GList * endmark_list, GlyrQuery * s, l
                     cb_object * capo = NULL;
                     curl_easy_getinfo (msg->easy_handle, CURLINFO_PRIVATE, ( ( (char**) &capo) ) );
 
+                    /* Others may use our slot while we're parsing */
+                    if (capo && capo->has_slot)
+                    {
+                        capo->has_slot = FALSE;
+                        slot_release();
+                    }
+
                     /* It's useless if it's empty  */
                     if (capo && capo->cache && capo->cache->data == NULL)
                     {
@@ -863,15 +1776,20 @@ GList * async_download (GList * url_list, GList * endmark_list, GlyrQuery * s, l
                     /* Mark this cb_object as  */
                     capo->was_buffered = TRUE;
 
+                    if (capo->origin == NULL)
+                    {
+                        finished++;
+                    }
+
                     /* capo contains now the downloaded cache, ready to parse */
                     if (msg->data.result == CURLE_OK && capo && capo->cache)
                     {
-                        /* How many items from the callback will actually be added */
-                        gint to_add = 0;
-
-                        /* Stop download after this came in */
-                        bool stop_download = false;
-                        GList * cb_results = NULL;
+                        /* Only tuned queries learn, so successes and timeouts are counted alike */
+                        gdouble transfer_time = 0.0;
+                        if (s->autotune == TRUE && curl_easy_getinfo (easy_handle,CURLINFO_TOTAL_TIME,&transfer_time) == CURLE_OK)
+                        {
+                            autotune_record_transfer (s->type,capo->url,transfer_time);
+                        }
 
                         /* Set origin */
                         if (capo->cache->dsrc != NULL)
@@ -880,43 +1798,17 @@ GList * async_download (GList * url_list, GList * endmark_list, GlyrQuery * s, l
                         }
                         capo->cache->dsrc = g_strdup (capo->url);
 
-                        /* Call it if present */
-                        if (asdl_callback != NULL)
+                        if (parse_pool != NULL && capo->origin == NULL)
                         {
-                            /* Add parsed results or nothing if parsed result is empty */
-                            cb_results = asdl_callback (capo,userptr,&stop_download,&to_add);
+                            /* Merged below, once a worker parsed it */
+                            parsing++;
+                            g_thread_pool_push (parse_pool,capo,NULL);
                         }
-
-                        if (cb_results != NULL)
-                        {
-                            /* Fill in the source filed (dsrc) if not already done */
-                            for (GList * elem = cb_results; elem; elem = elem->next)
-                            {
-                                GlyrMemCache * item = elem->data;
-                                if (item && item->dsrc == NULL)
-                                {
-                                    /* Plugin didn't do any special download */
-                                    item->dsrc = g_strdup (capo->url);
-                                }
-                                item_list = g_list_prepend (item_list,item);
-                            }
-                            g_list_free (cb_results);
-                        }
-                        else if (to_add != 0)
-                        {
-                            /* Add it as raw data */
-                            item_list = g_list_prepend (item_list,capo->cache);
-                        }
-                        else
+                        else if (collect_results (capo,asdl_callback,userptr,&item_list,&terminate,&pipeline,abs_timeout) == TRUE &&
+                                 capo->origin == NULL && succeeded++ == 0)
                         {
-                            capo->consumed = TRUE;
-                            DL_free (capo->cache);
-                            capo->cache = NULL;
+                            first_result = (g_get_monotonic_time() - started_at) / (gdouble) G_TIME_SPAN_SECOND;
                         }
-
-                        /* So, shall we stop? */
-                        terminate = stop_download;
-
                     }
                     else
                     {
@@ -929,9 +1821,23 @@ GList * async_download (GList * url_list, GList * endmark_list, GlyrQuery * s, l
                         glyr_message (3,capo->s,"  On URL: ");
                         glyr_message (3,capo->s,"%s\n",capo->url);
 
+                        /* Too slow for the learned timeout; it has to grow again */
+                        if (msg->data.result == CURLE_OPERATION_TIMEDOUT && s->autotune == TRUE)
+                        {
+                            autotune_record_timeout (s->type,capo->url,capo->timeout);
+                        }
+
                         DL_free (capo->cache);
                         capo->cache = NULL;
                         capo->consumed = TRUE;
+
+                        /* A failed image leaves room for another URL */
+                        if (capo->origin != NULL)
+                        {
+                            pipeline.open--;
+                            ADD_ATOMIC_ITEMCTR (s,-1);
+                            backfill_images (s,&pipeline,abs_timeout);
+                        }
                     }
 
                     /* We're done with this one.. bybebye */
@@ -945,7 +1851,58 @@ GList * async_download (GList * url_list, GList * endmark_list, GlyrQuery * s, l
                     glyr_message (1,s,"Error: multiDownload-errorcode: %d\n",msg->msg);
                 }
             }
+
+            /* Merge what the workers parsed meanwhile; block shortly if nothing else is to be done */
+            guint64 merge_wait = (running_handles == 0 && pending == NULL && pipeline.spawned == NULL) ? 100 * 1000 : 0;
+            while (parsing > 0 && terminate == FALSE && GET_ATOMIC_SIGNAL_EXIT (s) == FALSE)
+            {
+                cb_object * capo = (merge_wait > 0) ? g_async_queue_timeout_pop (context.done,merge_wait)
+                                   : g_async_queue_try_pop (context.done);
+                if (capo == NULL)
+                {
+                    break;
+                }
+
+                parsing--;
+                merge_wait = 0;
+                if (collect_results (capo,asdl_callback,userptr,&item_list,&terminate,&pipeline,abs_timeout) == TRUE && succeeded++ == 0)
+                {
+                    first_result = (g_get_monotonic_time() - started_at) / (gdouble) G_TIME_SPAN_SECOND;
+                }
+            }
+
+            pending = sync_image_pipeline (&pipeline,cmHandle,&cb_list,pending);
+        }
+        slot_announce_waiting (&waiting_announced,0);
+        g_list_free (pending);
+
+        /* Spawned, but never started */
+        cb_list = g_list_concat (cb_list,pipeline.spawned);
+
+        if (parse_pool != NULL)
+        {
+            /* Results that came in too late are dropped */
+            g_atomic_int_set (&context.cancelled,TRUE);
+            g_thread_pool_free (parse_pool,FALSE,TRUE);
+
+            cb_object * capo = NULL;
+            while ( (capo = g_async_queue_try_pop (context.done) ) != NULL)
+            {
+                discard_prepared (capo);
+            }
+        }
+
+        if (context.done != NULL)
+        {
+            g_async_queue_unref (context.done);
+        }
+
+        /* Only provider waves tell something about how many providers to ask */
+        if (asdl_callback == call_provider_callback && GET_ATOMIC_SIGNAL_EXIT (s) == FALSE)
+        {
+            autotune_record_wave (s->type,finished,succeeded,first_result);
         }
+
         destroy_async_download (cb_list,cmHandle,free_caches);
     }
     return item_list;
@@ -1122,94 +2079,83 @@ static GList * kick_out_wrong_formats (GList * data_list, GlyrQuery * s)
 
 //////////////////////////////////////
 
-static void do_charset_conversion (MetaDataSource * source, GList * text_list)
+/* Charset conversion, entity decoding, validation and NFKC normalization of one text.
+ * Everything but the conversion and the normalization works inplace,
+ * and normalization is skipped for pure ASCII, which it would not change.
+ * Returns FALSE if the text is no valid UTF-8 although query->force_utf8 was set.
+ */
+static gboolean sanitize_text (GlyrQuery * query, MetaDataSource * source, GlyrMemCache * cache)
 {
-    if (source != NULL && text_list != NULL)
+    if (cache == NULL || cache->data == NULL)
     {
-        for (GList * elem = text_list; elem; elem = elem->next)
-        {
-            GlyrMemCache * cache = elem->data;
+        return TRUE;
+    }
 
-            /* We might need to unescape the HTML Utf8 encoded strings first, this is done later anyway. */
-            gchar * utf8_string = unescape_html_UTF8 (cache->data);
-            if (utf8_string != NULL)
-            {
-                gsize new_len;
-                gchar * conv = convert_charset (utf8_string,"UTF-8",source->encoding,&new_len);
-                if (conv != NULL)
-                {
-                    cache->size = new_len;
-                    g_free (cache->data);
-                    cache->data = conv;
-                }
-                g_free (utf8_string);
-            }
+    if (source->encoding != NULL)
+    {
+        gsize new_size = 0;
+        gchar * conv = convert_to_utf8_cached (cache->data,cache->size,source->encoding,&new_size);
+        if (conv != NULL)
+        {
+            g_free (cache->data);
+            cache->data = conv;
+            cache->size = new_size;
         }
-    }
-}
 
-//////////////////////////////////////
+        /* Those sites usually deliver HTML entities too */
+        cache->size = unescape_html_UTF8_inplace (cache->data,cache->size);
+    }
 
-static GList * check_for_forced_utf8 (GlyrQuery * query, GList * text_list)
-{
-    gint deleted = 0;
-    GList * new_head = text_list;
-    if (query != NULL && text_list != NULL && query->force_utf8 == TRUE)
+    gsize ascii = 0;
+    while (ascii < cache->size && (guchar) cache->data[ascii] < 0x80)
     {
-        glyr_message (2,query,"#[%02d/%02d] Checking encoding [",g_list_length (text_list),query->number);
-
-        GList * elem = text_list;
-        while (elem != NULL)
-        {
-            GlyrMemCache * cache = elem->data;
+        ascii++;
+    }
 
-            const gchar * end_of_valid_utf8 = NULL;
-            if (cache && g_utf8_validate (cache->data,cache->size,&end_of_valid_utf8) == FALSE)
-            {
-                /* UTF8 was forced, and this cache didn't pass -> deletre */
-                glyr_message (2,query,"!");
+    if (ascii == cache->size)
+    {
+        return TRUE;
+    }
 
-                DL_free (cache);
-                deleted++;
+    if (g_utf8_validate (cache->data + ascii,cache->size - ascii,NULL) == FALSE)
+    {
+        return (query->force_utf8 == FALSE);
+    }
 
-                GList * to_delete = elem;
-                elem = elem->next;
-                new_head = g_list_delete_link (new_head,to_delete);
-                continue;
-            }
-            else
-            {
-                glyr_message (2,query,".");
-                elem = elem->next;
-            }
-        }
-        glyr_message (2,query,"] (-%d item(s) less)\n",deleted);
+    gchar * normalized_utf8 = g_utf8_normalize (cache->data,cache->size,G_NORMALIZE_NFKC);
+    if (normalized_utf8 != NULL)
+    {
+        g_free (cache->data);
+        cache->data = normalized_utf8;
+        cache->size = strlen (normalized_utf8);
     }
-    return new_head;
+    return TRUE;
 }
 
 //////////////////////////////////////
 
-static void normalize_utf8 (GList * text_list)
+/* Runs sanitize_text() on every item, dropping the ones failing */
+static GList * sanitize_texts (GlyrQuery * query, MetaDataSource * source, GList * text_list)
 {
-    for (GList * elem = text_list; elem; elem = elem->next)
+    gint deleted = 0;
+    GList * elem = text_list;
+    while (elem != NULL)
     {
-        GlyrMemCache * cache = elem->data;
-        if (cache != NULL && cache->data)
+        GList * next = elem->next;
+        if (sanitize_text (query,source,elem->data) == FALSE)
         {
-            if (g_utf8_validate (cache->data,-1,NULL) != FALSE)
-            {
-                gchar * normalized_utf8 = g_utf8_normalize (cache->data,-1,G_NORMALIZE_NFKC);
-                if (normalized_utf8 != NULL)
-                {
-                    /* Swap cache contents */
-                    g_free (cache->data);
-                    cache->data = normalized_utf8;
-                    cache->size = strlen (normalized_utf8);
-                }
-            }
+            DL_free (elem->data);
+            text_list = g_list_delete_link (text_list,elem);
+            deleted++;
         }
+        elem = next;
+    }
+
+    if (deleted > 0)
+    {
+        glyr_message (2,query,"#[%02d/%02d] Dropped %d item(s) with invalid UTF-8\n",g_list_length (text_list),query->number,deleted);
     }
+    return text_list;
 }
 
 //////////////////////////////////////
@@ -1233,6 +2179,12 @@ static gint delete_already_cached_items (cb_object * capo, GList ** list)
                 item->dsrc = g_strdup (item->data);
             }
 
+            /* The db knows items by their md5sum */
+            if (item != NULL)
+            {
+                update_md5sum (item);
+            }
+
             if (item && db_contains (capo->s->local_db,item) )
             {
                 GList * to_delete = elem;
@@ -1271,6 +2223,56 @@ static void fix_data_types (GList * list, MetaDataSource * src, GlyrQuery * quer
 }
 
 
+//////////////////////////////////////
+
+/* First half of call_provider_callback(), usually run in a worker thread:
+ * Parse the page and bring the items into shape.
+ * Only capo and the new items are touched here, everything shared is left to call_provider_callback().
+ */
+static GList * prepare_provider_items (cb_object * capo, void * userptr)
+{
+    GList * raw_parsed_data = NULL;
+    MetaDataSource * plugin = g_hash_table_lookup ( (GHashTable *) userptr,capo->url);
+    if (plugin != NULL)
+    {
+        /* Call the provider's parser, and see how well the strings it compared matched */
+        g_private_set (&parse_distance,NULL);
+        raw_parsed_data = plugin->parser (capo);
+        capo->match_distance = GPOINTER_TO_SIZE (g_private_get (&parse_distance) );
+
+        /* Set the default type if not known otherwise */
+        fix_data_types (raw_parsed_data,plugin,capo->s);
+
+        /* We shouldn't check (e.g) lyrics if they are a valid URL ;-) */
+        if (capo->s->imagejob == TRUE)
+        {
+            raw_parsed_data = kick_out_wrong_formats (raw_parsed_data,capo->s);
+        }
+        else
+        {
+            raw_parsed_data = sanitize_texts (capo->s,plugin,raw_parsed_data);
+        }
+    }
+    return raw_parsed_data;
+}
+
+//////////////////////////////////////
+
+/* Remember that plugin answered, and if it had something - dupes and cached items count too */
+static void note_answer (GlyrQuery * s, MetaDataSource * plugin, GList * items)
+{
+    RunState * state = s->run_state;
+    if (state != NULL && plugin->name != NULL)
+    {
+        gboolean found = GPOINTER_TO_INT (g_hash_table_lookup (state->answered,plugin->name) );
+        for (GList * elem = items; elem && found == FALSE; elem = elem->next)
+        {
+            found = (elem->data != NULL);
+        }
+        g_hash_table_insert (state->answered, (gpointer) plugin->name,GINT_TO_POINTER (found) );
+    }
+}
+
 //////////////////////////////////////
 
 /* The actual call to the metadata provider here, coming from the downloader, triggered by start_engine() */
@@ -1285,78 +2287,102 @@ static GList * call_provider_callback (cb_object * capo, void * userptr, bool *
 
         if (plugin != NULL)
         {
-            if (capo->s->itemctr < capo->s->number)
+            /* Parse now if no worker did it already */
+            if (capo->is_prepared == FALSE)
             {
-                /* Call the provider's parser */
-                GList * raw_parsed_data = plugin->parser (capo);
+                capo->prepared = prepare_provider_items (capo,userptr);
+                capo->is_prepared = TRUE;
+            }
 
-                /* Set the default type if not known otherwise */
-                fix_data_types (raw_parsed_data,plugin,capo->s);
+            GList * raw_parsed_data = capo->prepared;
+            capo->prepared = NULL;
+            note_answer (capo->s,plugin,raw_parsed_data);
 
-                /* Also do some duplicate check already */
-                gsize less = delete_dupes (raw_parsed_data,capo->s);
-                if (less > 0)
-                {
-                    gsize items_now = g_list_length (raw_parsed_data) + capo->s->itemctr - less;
-                    glyr_message (2,capo->s,"#[%02d/%02d] Inner check found %ld dupes\n",items_now,capo->s->number,less);
-                }
+            /* Also do some duplicate check already */
+            gsize less = delete_dupes (&raw_parsed_data,capo->s);
+            if (less > 0)
+            {
+                gsize items_now = g_list_length (raw_parsed_data) + capo->s->itemctr;
+                glyr_message (2,capo->s,"#[%02d/%02d] Inner check found %ld dupes\n",items_now,capo->s->number,less);
+            }
+
+            /* Look up if items already in cache */
+            less = delete_already_cached_items (capo,&raw_parsed_data);
+            if (less > 0)
+            {
+                gsize items_now = g_list_length (raw_parsed_data) + capo->s->itemctr - less;
+                glyr_message (2,capo->s,"#[%02d/%02d] DB lookup found %ld dupes\n",items_now,capo->s->number,less);
+            }
 
-                /* Look up if items already in cache */
-                less = delete_already_cached_items (capo,&raw_parsed_data);
-                if (less > 0)
+            /* Only reference to the plugin -> copy providername */
+            raw_parsed_data = g_list_remove_all (raw_parsed_data,NULL);
+            for (GList * elem = raw_parsed_data; elem; elem = elem->next)
+            {
+                GlyrMemCache * item = elem->data;
+                item->prov = g_strdup (plugin->name);
+                item->score = score_item (capo->s,plugin->quality,capo->match_distance);
+                if (capo->s->imagejob == TRUE)
                 {
-                    gsize items_now = g_list_length (raw_parsed_data) + capo->s->itemctr - less;
-                    glyr_message (2,capo->s,"#[%02d/%02d] DB lookup found %ld dupes\n",items_now,capo->s->number,less);
+                    item->score = score_image_url (item->score,item->data);
                 }
+            }
+
+            /* Download the most promising images first, the others are held back */
+            gboolean pipelined = (capo->s->imagejob == TRUE && capo->s->download == TRUE);
+            if (pipelined == TRUE)
+            {
+                raw_parsed_data = g_list_sort (raw_parsed_data,compare_score);
+            }
 
-                /* Any items left to kill? */
-                if (g_list_length (raw_parsed_data) != 0)
+            if (raw_parsed_data != NULL)
+            {
+                for (GList * elem = raw_parsed_data; elem; elem = elem->next)
                 {
-                    /* We shouldn't check (e.g) lyrics if they are a valid URL ;-) */
-                    if (capo->s->imagejob == TRUE)
-                    {
-                        raw_parsed_data = kick_out_wrong_formats (raw_parsed_data,capo->s);
-                    }
-                    else /* We should look if charset conversion is requested */
+                    GlyrMemCache * item = elem->data;
+                    if (item != NULL)
                     {
-                        normalize_utf8 (raw_parsed_data);
-                        if (plugin->encoding != NULL)
+                        if (text_set_merge (capo->s,item) == TRUE)
                         {
-                            glyr_message (2,capo->s,"#[%02d/%02d] Attempting to convert charsets\n",g_list_length (raw_parsed_data),capo->s->number);
-                            do_charset_conversion (plugin, raw_parsed_data);
+                            /* Same text with other whitespace or markup - does not count */
+                            glyr_message (2,capo->s,"#[%02d/%02d] %s delivered a near duplicate text\n",capo->s->itemctr,capo->s->number,plugin->name);
+                            DL_free (item);
+                            item = NULL;
                         }
-                        raw_parsed_data = check_for_forced_utf8 (capo->s,raw_parsed_data);
-                    }
-
-                    if (g_list_length (raw_parsed_data) != 0)
-                    {
-                        for (GList * elem = raw_parsed_data; elem; elem = elem->next)
+                        else if (capo->s->itemctr < capo->s->number)
                         {
-                            GlyrMemCache * item = elem->data;
-                            if (item != NULL)
+                            ADD_ATOMIC_ITEMCTR (capo->s,1);
+
+                            /* Images are downloaded right away, in the same async_download() */
+                            if (pipelined == TRUE)
                             {
-                                if (capo->s->itemctr < capo->s->number)
-                                {
-                                    /* Only reference to the plugin -> copy providername */
-                                    item->prov = g_strdup (plugin->name);
-                                    parsed = g_list_prepend (parsed,item);
-                                    capo->s->itemctr++;
-                                }
-                                else /* Not needed anymore. Forget this item */
-                                {
-                                    DL_free (item);
-                                    item = NULL;
-
-                                    /* Also skip other downloads */
-                                    *stop_download = TRUE;
-                                }
+                                capo->follow_ups = g_list_prepend (capo->follow_ups,item);
+                            }
+                            else
+                            {
+                                parsed = g_list_prepend (parsed,item);
                             }
                         }
+                        else /* Not needed anymore. Forget this item, or keep it for back-fill */
+                        {
+                            RunState * state = capo->s->run_state;
+                            if (pipelined == TRUE && state != NULL)
+                            {
+                                state->reserve = g_list_insert_sorted (state->reserve,item,compare_score);
+                            }
+                            else
+                            {
+                                DL_free (item);
+                            }
+                            item = NULL;
 
-                        /* Forget those pointers */
-                        g_list_free (raw_parsed_data);
+                            /* Also skip other downloads */
+                            *stop_download = TRUE;
+                        }
                     }
                 }
+
+                /* Forget those pointers */
+                g_list_free (raw_parsed_data);
             }
         }
         else
@@ -1496,25 +2522,6 @@ static GList * get_queued (GlyrQuery * s, MetaDataFetcher * fetcher, gint * fire
 
 //////////////////////////////////////
 
-gboolean is_in_result_list (GlyrMemCache * cache, GList * result_list)
-{
-    gboolean result = FALSE;
-    if (cache != NULL)
-    {
-        for (GList * elem = result_list; elem; elem = elem->next)
-        {
-            GlyrMemCache * item = elem->data;
-            if (memcmp (cache->md5sum, item->md5sum, 16) == 0)
-            {
-                result = TRUE;
-            }
-        }
-    }
-    return result;
-}
-
-//////////////////////////////////////
-
 static void execute_query (GlyrQuery * query, MetaDataFetcher * fetcher, GList * source_list, gboolean * stop_me, GList ** result_list)
 {
     GList * url_list = NULL;
@@ -1586,11 +2593,18 @@ static void execute_query (GlyrQuery * query, MetaDataFetcher * fetcher, GList *
                 }
                 else
                 {
-                    offline_list = check_for_forced_utf8 (query,offline_list);
+                    offline_list = sanitize_texts (query,source,offline_list);
                 }
 
                 for (GList * off_elem = offline_list; off_elem && query->itemctr < query->number; off_elem = off_elem->next)
                 {
+                    /* The same image may be in several files of the musictree */
+                    if (query->imagejob && image_set_admit (query,off_elem->data) == FALSE)
+                    {
+                        DL_free (off_elem->data);
+                        continue;
+                    }
+
                     GLYR_ERROR result = GLYRE_OK;
                     if (query->callback.download != NULL)
                     {
@@ -1599,8 +2613,24 @@ static void execute_query (GlyrQuery * query, MetaDataFetcher * fetcher, GList *
 
                     if (result != GLYRE_STOP_PRE && result != GLYRE_SKIP)
                     {
-                        cached_items = g_list_prepend (cached_items,off_elem->data);
-                        query->itemctr++;
+                        /* Providers should not deliver the same text again */
+                        text_set_merge (query,off_elem->data);
+
+                        /* Offline providers look up the exact artist/album/title */
+                        GlyrMemCache * off_item = off_elem->data;
+                        off_item->score = score_item (query,source->quality,1);
+
+                        cached_items = g_list_prepend (cached_items,off_item);
+                        ADD_ATOMIC_ITEMCTR (query,1);
+
+                        if (score_is_confident (query,off_item) == TRUE)
+                        {
+                            proceed = FALSE;
+                        }
+                    }
+                    else if (query->imagejob)
+                    {
+                        image_set_forget (query,off_elem->data);
                     }
 
                     if (result == GLYRE_STOP_PRE || result == GLYRE_STOP_POST)
@@ -1621,21 +2651,25 @@ static void execute_query (GlyrQuery * query, MetaDataFetcher * fetcher, GList *
                                          query,
                                          url_list_length / query->timeout  + 1,
                                          MIN ( (gint) (url_list_length / query->parallel + 3), query->number + 2),
+                                         prepare_provider_items,
                                          call_provider_callback,
                                          url_table,
                                          TRUE);
         }
 
+        /* Images the pipeline replaced by larger copies */
+        drop_superseded_images (query,&raw_parsed);
+
         /* Now finalize our retrieved items */
         if (g_list_length (raw_parsed) != 0)
         {
 
             /* Kill duplicates before finalizing */
-            int pre_less = delete_dupes (raw_parsed,query);
+            int pre_less = delete_dupes (&raw_parsed,query);
             if (pre_less > 0)
             {
                 glyr_message (2,query,"- Prefiltering double data: (-%d item(s) less)\n",pre_less);
-                query->itemctr -= pre_less;
+                ADD_ATOMIC_ITEMCTR (query,-pre_less);
             }
 
             glyr_message (2,query,"---- \n");
@@ -1644,6 +2678,16 @@ static void execute_query (GlyrQuery * query, MetaDataFetcher * fetcher, GList *
                 /* Call finalize to sanitize data, or download given URLs */
                 ready_caches = fetcher->finalize (query, raw_parsed,stop_me, result_list);
 
+                /* Only what survived the finalizer may end the search */
+                for (GList * elem = ready_caches; elem; elem = elem->next)
+                {
+                    GlyrMemCache * ready = elem->data;
+                    if (ready != NULL && score_is_confident (query,NULL) == FALSE && score_is_confident (query,ready) == TRUE)
+                    {
+                        glyr_message (2,query,"- %s delivered a confident result (%.2f)\n",ready->prov ? ready->prov : "?",ready->score);
+                    }
+                }
+
                 /* Raw data not needed anymore */
                 g_list_free (raw_parsed);
                 raw_parsed = NULL;
@@ -1672,10 +2716,13 @@ static void execute_query (GlyrQuery * query, MetaDataFetcher * fetcher, GList *
         GlyrMemCache * result_cache = result->data;
         if (result_cache != NULL)
         {
+            /* Items of offline providers did not go through a finalizer */
+            result_set_add (query,result_cache);
             *result_list = g_list_prepend (*result_list,result->data);
         }
     }
     g_list_free (sub_result_list);
+    drop_superseded_images (query,result_list);
 }
 //////////////////////////////////////
 
@@ -1692,6 +2739,118 @@ static void print_trigger (GlyrQuery * query, GList * src_list)
 
 //////////////////////////////////////
 
+/* Resolve as much as possible from the local db before anything goes online.
+ * The local provider is marked as fired, so it never ends up in a network wave.
+ * Returns TRUE if the db was searched.
+ */
+static gboolean resolve_from_cache (GlyrQuery * query, MetaDataFetcher * fetcher, gint * fired, gboolean * stop_me, GList ** result_list)
+{
+    gboolean searched = FALSE;
+
+    gint pos = 0;
+    for (GList * elem = fetcher->provider; elem; elem = elem->next, ++pos)
+    {
+        MetaDataSource * src = elem->data;
+        if (g_strcmp0 (src->name,"local") == 0)
+        {
+            fired[pos]++;
+            if (query->local_db != NULL && provider_is_enabled (query,src) == TRUE)
+            {
+                GList * single = g_list_prepend (NULL,src);
+                print_trigger (query,single);
+                execute_query (query,fetcher,single,stop_me,result_list);
+                g_list_free (single);
+                searched = TRUE;
+            }
+        }
+    }
+
+    if (searched == TRUE)
+    {
+        gint found = g_list_length (*result_list);
+        if (found >= query->number)
+        {
+            glyr_message (2,query,"- All %d item(s) found in local db, not going online.\n",found);
+        }
+        else
+        {
+            glyr_message (2,query,"- %d item(s) found in local db, searching %d more.\n",found,query->number - found);
+        }
+    }
+    return searched;
+}
+
+//////////////////////////////////////
+
+/* Mark the providers that had nothing for query lately as fired, so no wave asks them.
+ * Returns TRUE if no enabled provider is left.
+ */
+static gboolean skip_known_misses (GlyrQuery * query, MetaDataFetcher * fetcher, gint * fired)
+{
+    if (query->local_db == NULL || query->db_autoread == FALSE)
+    {
+        return FALSE;
+    }
+
+    GHashTable * misses = db_miss_lookup (query->local_db,query);
+    if (misses == NULL)
+    {
+        return FALSE;
+    }
+
+    gint left = 0;
+    gint pos = 0;
+    for (GList * elem = fetcher->provider; elem; elem = elem->next, ++pos)
+    {
+        MetaDataSource * src = elem->data;
+        if (fired[pos] == 0 && provider_is_enabled (query,src) == TRUE)
+        {
+            if (g_hash_table_contains (misses,src->name) )
+            {
+                glyr_message (2,query,"- Skipping %s, it had nothing lately.\n",src->name);
+                fired[pos]++;
+            }
+            else
+            {
+                left++;
+            }
+        }
+    }
+
+    g_hash_table_destroy (misses);
+    return (left == 0);
+}
+
+//////////////////////////////////////
+
+/* Write down which providers answered without having anything, see glyr_db_set_miss_ttl() */
+static void remember_misses (GlyrQuery * query)
+{
+    RunState * state = query->run_state;
+    if (query->local_db == NULL || query->db_autowrite == FALSE || g_hash_table_size (state->answered) == 0 ||
+            db_miss_ttl (query->local_db) <= 0)
+    {
+        return;
+    }
+
+    glyr_db_batch_begin (query->local_db);
+
+    GHashTableIter iter;
+    gpointer name, found;
+    g_hash_table_iter_init (&iter,state->answered);
+    while (g_hash_table_iter_next (&iter,&name,&found) )
+    {
+        if (g_strcmp0 (name,"local") != 0)
+        {
+            db_miss_update (query->local_db,query,name,GPOINTER_TO_INT (found) );
+        }
+    }
+
+    glyr_db_batch_end (query->local_db);
+}
+
+//////////////////////////////////////
+
 GList * start_engine (GlyrQuery * query, MetaDataFetcher * fetcher, GLYR_ERROR * err)
 {
     gsize list_len = g_list_length (fetcher->provider);
@@ -1702,7 +2861,21 @@ GList * start_engine (GlyrQuery * query, MetaDataFetcher * fetcher, GLYR_ERROR *
     gboolean stop_now = FALSE;
 
     GList * src_list = NULL, * result_list = NULL;
+    run_state_init (query);
+
+    /* Cache first - only the remainder goes to the network */
+    something_was_searched = resolve_from_cache (query,fetcher,fired,&stop_now,&result_list);
+    stop_now = (GET_ATOMIC_SIGNAL_EXIT (query) ) ? TRUE : stop_now;
+
+    /* Providers known to have nothing are not asked again */
+    if (stop_now == FALSE && skip_known_misses (query,fetcher,fired) == TRUE)
+    {
+        glyr_message (2,query,"- No provider had anything lately, not going online.\n");
+        something_was_searched = TRUE;
+    }
+
     while ( (stop_now == FALSE) &&
+            (score_is_confident (query,NULL) == FALSE) &&
             (g_list_length (result_list) < (gsize) query->number) &&
             (src_list = get_queued (query, fetcher, fired) ) != NULL)
     {
@@ -1722,6 +2895,15 @@ GList * start_engine (GlyrQuery * query, MetaDataFetcher * fetcher, GLYR_ERROR *
         stop_now = (GET_ATOMIC_SIGNAL_EXIT (query) ) ? TRUE : stop_now;
     }
 
+    /* Best first; g_list_sort() is stable, so equal items keep their order */
+    result_list = g_list_sort (result_list,compare_score);
+
+    /* An interrupted run might not have heard the answer of everyone */
+    if (GET_ATOMIC_SIGNAL_EXIT (query) == FALSE)
+    {
+        remember_misses (query);
+    }
+
     if (something_was_searched == FALSE)
     {
         if (err != NULL)
@@ -1734,6 +2916,8 @@ GList * start_engine (GlyrQuery * query, MetaDataFetcher * fetcher, GLYR_ERROR *
             query->q_errno = GLYRE_NO_PROVIDER;
         }
     }
+
+    run_state_free (query);
     return result_list;
 }
 
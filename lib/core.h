@@ -57,6 +57,35 @@
 #define GET_ATOMIC_SIGNAL_EXIT(QUERY)   (g_atomic_int_get(&((QUERY)->signal_exit)))
 #define SET_ATOMIC_SIGNAL_EXIT(QUERY,V) (g_atomic_int_set(&((QUERY)->signal_exit),V))
 
+/* Priority may be changed from another thread while the query runs */
+#define GET_ATOMIC_PRIORITY(QUERY) ((GLYR_PRIORITY) g_atomic_int_get((gint *) &((QUERY)->priority)))
+
+/* Parsers read the item counter in worker threads while the downloader changes it */
+#define GET_ATOMIC_ITEMCTR(QUERY)     (g_atomic_int_get(&((QUERY)->itemctr)))
+#define ADD_ATOMIC_ITEMCTR(QUERY,NUM) (g_atomic_int_add(&((QUERY)->itemctr),(NUM)))
+
+/* Number of transfers that may run at the same time in this process,
+ * shared by all queries - interactive only ones too, see glyr_opt_priority().
+ * Background queries may not use the reserved ones.
+ */
+#define GLYR_TRANSFER_SLOTS 32
+#define GLYR_TRANSFER_SLOTS_RESERVED 8
+
+/* Texts of these types count as duplicates if they are this similar */
+#define TYPE_IS_PROSE(TYPE) (TYPE == GLYR_TYPE_LYRICS || TYPE == GLYR_TYPE_ARTIST_BIO || TYPE == GLYR_TYPE_ALBUM_REVIEW || TYPE == GLYR_TYPE_GUITARTABS)
+#define TEXT_MAX_SIMILARITY 0.8
+
+/* Images of this size (or larger) get the full size bonus of their score */
+#define SCORE_IMAGE_FULL_SIZE (256 * 1024)
+#define SCORE_IMAGE_SIZE_WEIGHT 0.3
+
+/* Same for the size guessed from the URL of an image, before it is downloaded */
+#define SCORE_IMAGE_FULL_EDGE 600
+#define SCORE_IMAGE_HINT_WEIGHT 0.2
+
+/* Max. number of threads parsing downloaded pages of one query */
+#define GLYR_PARSE_THREADS 4
+
 /* Feels a little hackish - but works with extremely high probability :-) */
 #define QUERY_INITIALIZER 0xDEADBEEF
 #define QUERY_IS_INITALIZED(Q) (Q && Q->is_initalized == QUERY_INITIALIZER)
@@ -107,10 +136,67 @@ typedef struct cb_object
     // DLBuffer data
     DLBufferContainer * dlbuffer;
 
+    // Does this transfer hold one of the shared transfer slots?
+    gboolean has_slot;
+
+    // Timeout in seconds this transfer was started with
+    long timeout;
+
+    // When it runs out (monotonic), set once the transfer got its first slot
+    gint64 deadline;
+
+    // Items the prepare callback built in a worker thread
+    GList * prepared;
+    gboolean is_prepared;
+
+    // Best levenshtein_strnormcmp() distance the parser saw, +1; 0 if none
+    gsize match_distance;
+
+    // Image URLs found by the callback, downloaded by the same async_download()
+    GList * follow_ups;
+
+    // For such an image download: the URL item it came from
+    GlyrMemCache * origin;
+
 } cb_object;
 
 /*------------------------------------------------------*/
 
+// Bookkeeping of one start_engine() run, kept in query->run_state
+// Items are only compared by their content_hash(), so each check costs O(1)
+typedef struct RunState
+{
+    // content_hash() -> GlyrMemCache of every item parsed so far
+    GHashTable * parsed;
+
+    // content_hash() of all items that made it to the results
+    GHashTable * results;
+
+    // Perceptual hashes of the accepted images, see imghash.c
+    GArray * images;
+
+    // Accepted images a larger copy showed up for, removed from the results again
+    GList * superseded;
+
+    // Image URL without size hints -> largest size of it started, see image_variant_wanted()
+    GHashTable * variants;
+
+    // MinHash signatures of the parsed texts, see text_set_merge()
+    GArray * texts;
+
+    // Set once an item reached query->confidence
+    gboolean confident;
+
+    // Image URLs beyond query->number, best first; downloaded if others fail
+    GList * reserve;
+
+    // Name of every provider whose page was parsed -> TRUE if it had something
+    GHashTable * answered;
+
+} RunState;
+
+/*------------------------------------------------------*/
+
 // Internal representation of one metadataprovider
 // PLEASE FILL _ALL_ FIELDS!
 typedef struct MetaDataFetcher
@@ -172,10 +258,20 @@ typedef struct MetaDataSource
 /*------------------------------------------------------*/
 
 typedef GList* (*AsyncDLCB) (cb_object*,void *,bool*,gint*);
-GList * async_download (GList * url_list, GList * endmark_list, GlyrQuery * s, long parallel_fac, long timeout_fac, AsyncDLCB callback, void * userptr, gboolean free_caches);
+
+/* Optional CPU heavy first half of an AsyncDLCB, run in a worker thread while other transfers go on.
+ * It may only touch capo and the items it creates, the result is stored in capo->prepared.
+ */
+typedef GList* (*AsyncPrepareCB) (cb_object*,void *);
+
+GList * async_download (GList * url_list, GList * endmark_list, GlyrQuery * s, long parallel_fac, long timeout_fac, AsyncPrepareCB prepare, AsyncDLCB callback, void * userptr, gboolean free_caches);
 GList * start_engine (GlyrQuery * query, MetaDataFetcher * fetcher, GLYR_ERROR * err);
 GlyrMemCache * download_single (const char* url, GlyrQuery * s, const char * end);
 
+/* Set up / free the DNS and TLS session cache shared by all transfers, and the connections of this thread, see glyr_init() */
+void share_pool_init (void);
+void share_pool_cleanup (void);
+
 /*------------------------------------------------------*/
 
 GlyrMemCache * DL_init (void);
@@ -191,8 +287,21 @@ void glist_free_full (GList * List, void (* free_func) (void * ptr) );
 /*------------------------------------------------------*/
 
 gboolean size_is_okay (int sZ, int min, int max);
-gboolean is_in_result_list (GlyrMemCache * cache, GList * result_list);
+gboolean result_set_add (GlyrQuery * s, GlyrMemCache * cache);
 gboolean provider_is_enabled (GlyrQuery * q, MetaDataSource * f);
 gboolean continue_search (gint current, GlyrQuery * s);
 
+/*------------------------------------------------------*/
+
+/* Called by levenshtein_strnormcmp(), remembers the best match the current parser saw */
+void record_match_distance (gsize distance);
+
+/* Mix the size of a downloaded image into the score of its URL */
+float score_image (float url_score, gsize size);
+
+/* Check an image downloaded from the URL item origin, and give it the fields of origin.
+ * Returns TRUE if it belongs to the results.
+ */
+gboolean accept_image (GlyrQuery * s, GlyrMemCache * image, GlyrMemCache * origin, GLYR_DATA_TYPE type, bool * stop_download);
+
 #endif
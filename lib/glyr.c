@@ -27,6 +27,8 @@
 #include "blacklist.h"
 #include "cache.h"
 #include "stringlib.h"
+#include "prefetch.h"
+#include "autotune.h"
 
 //////////////////////////////////
 
@@ -231,6 +233,7 @@ __attribute__ ( (visibility ("default") ) )
 void glyr_cache_set_data (GlyrMemCache * cache, const char * data, int len)
 {
     DL_set_data (cache,data,len);
+    update_md5sum (cache);
 }
 
 /////////////////////////////////
@@ -589,6 +592,52 @@ GLYR_ERROR glyr_opt_normalize (GlyrQuery * s, GLYR_NORMALIZATION norm)
     return GLYRE_OK;
 }
 
+/////////////////////////////////
+
+__attribute__ ( (visibility ("default") ) )
+GLYR_ERROR glyr_opt_priority (GlyrQuery * s, GLYR_PRIORITY priority)
+{
+    if (s == NULL) return GLYRE_EMPTY_STRUCT;
+    if (priority != GLYR_PRIORITY_INTERACTIVE && priority != GLYR_PRIORITY_BACKGROUND)
+    {
+        return GLYRE_BAD_VALUE;
+    }
+
+    g_atomic_int_set ( (gint *) &s->priority, priority);
+    return GLYRE_OK;
+}
+
+/////////////////////////////////
+
+__attribute__ ( (visibility ("default") ) )
+GLYR_ERROR glyr_opt_autotune (GlyrQuery * s, bool autotune)
+{
+    if (s == NULL) return GLYRE_EMPTY_STRUCT;
+    s->autotune = autotune;
+    return GLYRE_OK;
+}
+
+/////////////////////////////////
+
+__attribute__ ( (visibility ("default") ) )
+GLYR_ERROR glyr_opt_img_dedup (GlyrQuery * s, bool img_dedup)
+{
+    if (s == NULL) return GLYRE_EMPTY_STRUCT;
+    s->img_dedup = img_dedup;
+    return GLYRE_OK;
+}
+
+/////////////////////////////////
+
+__attribute__ ( (visibility ("default") ) )
+GLYR_ERROR glyr_opt_confidence (GlyrQuery * s, float threshold)
+{
+    if (s == NULL) return GLYRE_EMPTY_STRUCT;
+    if (threshold < 0.0 || threshold > 1.0) return GLYRE_BAD_VALUE;
+    s->confidence = threshold;
+    return GLYRE_OK;
+}
+
 /////////////////////////////////
 /////////////////////////////////
 /////////////////////////////////
@@ -634,6 +683,10 @@ static void set_query_on_defaults (GlyrQuery * glyrs)
     glyrs->lang = GLYR_DEFAULT_LANG;
     glyrs->lang_aware_only = GLYR_DEFAULT_LANG_AWARE_ONLY;
     glyrs->normalization = GLYR_NORMALIZE_AGGRESSIVE | GLYR_NORMALIZE_ALL;
+    glyrs->priority = GLYR_DEFAULT_PRIORITY;
+    glyrs->autotune = GLYR_DEFAULT_AUTOTUNE;
+    glyrs->img_dedup = GLYR_DEFAULT_IMG_DEDUP;
+    glyrs->confidence = GLYR_DEFAULT_CONFIDENCE;
     glyrs->signal_exit = FALSE;
     glyrs->itemctr = 0;
 
@@ -680,7 +733,130 @@ void glyr_query_destroy (GlyrQuery * sets)
 __attribute__ ( (visibility ("default") ) )
 GlyrMemCache * glyr_download (const char * url, GlyrQuery * s)
 {
-    return download_single (url,s,NULL);
+    /* Internal downloads don't need the md5sum, the user might */
+    GlyrMemCache * cache = download_single (url,s,NULL);
+    update_md5sum (cache);
+    return cache;
+}
+
+/////////////////////////////////
+
+/* Passed to materialize_callback() */
+struct materialize_data
+{
+    /* URL -> GList of the items showing it */
+    GHashTable * pending;
+    GLYR_DATA_TYPE type;
+    gint done;
+};
+
+/////////////////////////////////
+
+static GList * materialize_callback (cb_object * capo, void * userptr, bool * stop_download, gint * to_add)
+{
+    struct materialize_data * data = userptr;
+    GList * waiting = g_hash_table_lookup (data->pending,capo->url);
+
+    for (GList * elem = waiting; elem && capo->cache && capo->cache->data; elem = elem->next)
+    {
+        GlyrMemCache * item = elem->data;
+        gsize size = capo->cache->size;
+
+        /* The last one may take the buffer itself */
+        gchar * bytes = capo->cache->data;
+        if (elem->next != NULL)
+        {
+            bytes = g_memdup (capo->cache->data,size + 1);
+        }
+        else
+        {
+            capo->cache->data = NULL;
+            capo->cache->size = 0;
+        }
+
+        DL_set_data (item,bytes,size);
+        update_md5sum (item);
+        g_free (item->dsrc);
+        item->dsrc = g_strdup (capo->url);
+        item->is_image = true;
+        item->type = data->type;
+        item->score = score_image (item->score,size);
+        data->done++;
+    }
+    return NULL;
+}
+
+/////////////////////////////////
+
+/* What images a getter delivers, e.g. GLYR_TYPE_COVERART for GLYR_GET_COVERART */
+static GLYR_DATA_TYPE image_type_of (GLYR_GET_TYPE type)
+{
+    for (GList * elem = r_getFList(); elem; elem = elem->next)
+    {
+        MetaDataFetcher * fetcher = elem->data;
+        if (fetcher->type == type && fetcher->full_data == FALSE)
+        {
+            return fetcher->default_data_type;
+        }
+    }
+    return GLYR_TYPE_UNKNOWN;
+}
+
+/////////////////////////////////
+
+__attribute__ ( (visibility ("default") ) )
+int glyr_cache_materialize (GlyrMemCache * list, int n, GlyrQuery * s)
+{
+    GlyrQuery defaults;
+    GlyrQuery * query = s;
+    if (query == NULL)
+    {
+        glyr_query_init (&defaults);
+        query = &defaults;
+    }
+
+    struct materialize_data data =
+    {
+        .pending = g_hash_table_new_full (g_str_hash,g_str_equal,g_free, (GDestroyNotify) g_list_free),
+        .type    = image_type_of (query->type),
+        .done    = 0
+    };
+
+    /* Every URL is only downloaded once */
+    GList * url_list = NULL;
+    gint left = (n > 0) ? n : G_MAXINT;
+    for (GlyrMemCache * item = list; item && left > 0; item = item->next, left--)
+    {
+        if (item->is_image == false && item->type == GLYR_TYPE_IMG_URL && item->data != NULL)
+        {
+            GList * waiting = g_hash_table_lookup (data.pending,item->data);
+            if (waiting == NULL)
+            {
+                gchar * url = g_strdup (item->data);
+                g_hash_table_insert (data.pending,url,g_list_prepend (NULL,item) );
+                url_list = g_list_prepend (url_list,url);
+            }
+            else
+            {
+                waiting = g_list_append (waiting,item);
+            }
+        }
+    }
+
+    if (url_list != NULL)
+    {
+        /* All at once, over the connections earlier transfers of this thread kept open */
+        GList * rest = async_download (url_list,NULL,query,1,g_list_length (url_list) / 2 + 1,NULL,materialize_callback,&data,TRUE);
+        g_list_free (rest);
+        g_list_free (url_list);
+    }
+
+    g_hash_table_destroy (data.pending);
+    if (query == &defaults)
+    {
+        glyr_query_destroy (&defaults);
+    }
+    return data.done;
 }
 
 /////////////////////////////////
@@ -743,6 +919,7 @@ void glyr_init (void)
         {
             glyr_message (-1,NULL,"Fatal: libcurl failed to init\n");
         }
+        share_pool_init();
 
         /* Locale */
         if (setlocale (LC_ALL, "") == NULL)
@@ -769,7 +946,11 @@ void glyr_cleanup (void)
 {
     if (is_initalized == TRUE)
     {
+        /* Stop background jobs first, they still need everything below */
+        prefetch_shutdown();
+
         /* Curl no longer needed */
+        share_pool_cleanup();
         curl_global_cleanup();
 
         /* Destroy all fetchers */
@@ -778,6 +959,9 @@ void glyr_cleanup (void)
         /* Kill it again */
         blacklist_destroy();
 
+        /* Close cached iconv descriptors */
+        convert_cache_cleanup();
+
         is_initalized = FALSE;
     }
 }
@@ -800,6 +984,12 @@ static void auto_detect_parallel (MetaDataFetcher * fetcher, GlyrQuery * query)
         {
             query->parallel = fetcher->default_parallel;
         }
+
+        /* Trust what previous queries observed, once there's enough of it */
+        if (query->autotune == TRUE)
+        {
+            query->parallel = autotune_parallel (fetcher->type,query->parallel,g_list_length (fetcher->provider) );
+        }
     }
 }
 
@@ -854,6 +1044,33 @@ static void set_error (GLYR_ERROR err_in, GlyrQuery * query, GLYR_ERROR * err_ou
 /////////////////////////////////
 
 
+/* What a prefetch of the same item wrote to the db, at most query->number items */
+static GList * prefetched_results (GlyrQuery * query)
+{
+    GList * result = NULL;
+    gint counter = 0;
+
+    GlyrMemCache * head = glyr_db_lookup (query->local_db,query);
+    while (head != NULL)
+    {
+        GlyrMemCache * next = head->next;
+        if (counter < query->number)
+        {
+            head->cached = TRUE;
+            result = g_list_prepend (result,head);
+            counter++;
+        }
+        else
+        {
+            DL_free (head);
+        }
+        head = next;
+    }
+    return g_list_reverse (result);
+}
+
+/////////////////////////////////
+
 #define PRINT_NORMALIZED_ATTR(name, mode, var)              \
     if(var != NULL && query->verbosity >= 2)                \
     {                                                       \
@@ -889,6 +1106,8 @@ GlyrMemCache * glyr_get (GlyrQuery * query, GLYR_ERROR * e, int * length)
         }
 
         GList * result = NULL;
+        gpointer inflight = NULL;
+        gint user_parallel = query->parallel;
         set_error (GLYRE_UNKNOWN_GET, query, e);
 
         for (GList * elem = r_getFList(); elem; elem = elem->next)
@@ -932,8 +1151,21 @@ GlyrMemCache * glyr_get (GlyrQuery * query, GLYR_ERROR * e, int * length)
                     /* If ->parallel is <= 0, it gets autodetected */
                     auto_detect_parallel (item, query);
 
-                    /* Now start your engines, gentlemen */
-                    result = start_engine (query,item,e);
+                    /* Wait for a prefetch of the same item, if any */
+                    gboolean prefetched = FALSE;
+                    inflight = prefetch_enter (query,&prefetched);
+
+                    if (prefetched == TRUE)
+                    {
+                        /* It just searched the same, no need to do it again */
+                        glyr_message (2,query,"- Taking the results of the prefetch from the db\n");
+                        result = prefetched_results (query);
+                    }
+                    else
+                    {
+                        /* Now start your engines, gentlemen */
+                        result = start_engine (query,item,e);
+                    }
                     break;
                 }
                 else
@@ -946,6 +1178,12 @@ GlyrMemCache * glyr_get (GlyrQuery * query, GLYR_ERROR * e, int * length)
         /* Make this query reusable */
         query->itemctr = 0;
 
+        /* Tune again next time */
+        if (query->autotune == TRUE)
+        {
+            query->parallel = user_parallel;
+        }
+
         /* Start of the returned list */
         GlyrMemCache * head = NULL;
 
@@ -973,18 +1211,28 @@ GlyrMemCache * glyr_get (GlyrQuery * query, GLYR_ERROR * e, int * length)
             /* Count inserstions */
             gint db_inserts = 0;
 
+            /* All new results are written in one batch, linked to each other for that */
+            if (query->db_autowrite && query->local_db)
+            {
+                GlyrMemCache * fresh = NULL;
+                for (GList * elem = g_list_last (result); elem; elem = elem->prev)
+                {
+                    GlyrMemCache * item = elem->data;
+                    if (item->cached == FALSE)
+                    {
+                        item->next = fresh;
+                        fresh = item;
+                    }
+                }
+                db_inserts = glyr_db_insert_batch (query->local_db,query,fresh);
+            }
+
             /* link caches to each other */
             for (GList * elem = result; elem; elem = elem->next)
             {
                 GlyrMemCache * item = elem->data;
                 item->next = (elem->next) ? elem->next->data : NULL;
                 item->prev = (elem->prev) ? elem->prev->data : NULL;
-
-                if (query->db_autowrite && query->local_db && item->cached == FALSE)
-                {
-                    db_inserts++;
-                    glyr_db_insert (query->local_db,query,item);
-                }
             }
 
             if (db_inserts > 0)
@@ -1002,6 +1250,9 @@ GlyrMemCache * glyr_get (GlyrQuery * query, GLYR_ERROR * e, int * length)
             result = NULL;
         }
 
+        /* Items are in the db now, others may go on */
+        prefetch_leave (inflight);
+
         /* Done! */
         SET_ATOMIC_SIGNAL_EXIT (query,0);
         return head;
@@ -1014,6 +1265,18 @@ GlyrMemCache * glyr_get (GlyrQuery * query, GLYR_ERROR * e, int * length)
 
 /////////////////////////////////
 
+__attribute__ ( (visibility ("default") ) )
+GLYR_ERROR glyr_prefetch (GlyrQuery * query)
+{
+    if (is_initalized == FALSE || QUERY_IS_INITALIZED (query) == FALSE)
+    {
+        return (query == NULL) ? GLYRE_EMPTY_STRUCT : GLYRE_NO_INIT;
+    }
+    return prefetch_schedule (query);
+}
+
+/////////////////////////////////
+
 __attribute__ ( (visibility ("default") ) )
 int glyr_cache_write (GlyrMemCache * data, const char * path)
 {
@@ -91,6 +91,117 @@ extern "C"
      */
     GlyrMemCache * glyr_get (GlyrQuery * settings, GLYR_ERROR * error, int * length);
 
+    /**
+     * glyr_prefetch:
+     * @settings: The setting struct controlling glyr, a database must be set via glyr_opt_lookup_db()
+     *
+     * Searches for the same items as glyr_get() would, but in the background and with
+     * GLYR_PRIORITY_BACKGROUND. The results are not returned, but written to the database.
+     * A later glyr_get() with the same settings will then find them there.
+     *
+     * This is useful to warm the cache for the items a user will most likely want next,
+     * e.g. the cover of the next album in the playlist.
+     * The query is copied, so you may destroy or reuse @settings right after this call.
+     * The download callback is not called for prefetched items.
+     *
+     * If the same item is already being prefetched, or searched by glyr_get(), nothing happens.
+     * A glyr_get() for an item that is prefetched right now waits for the prefetch to finish,
+     * which then runs with the priority of the waiting query, and returns what it found
+     * without searching again (even if glyr_opt_db_autoread() is off).
+     *
+     * <note>
+     * <para>
+     * glyr_db_destroy() waits for all prefetches writing to this database,
+     * glyr_cleanup() stops all of them.
+     * </para>
+     * </note>
+     *
+     * Returns: GLYRE_OK if the prefetch was queued, GLYRE_BAD_VALUE if there is no database
+     */
+    GLYR_ERROR glyr_prefetch (GlyrQuery * settings);
+
+    /**
+     * glyr_plan_new:
+     * @settings: The query to start with, e.g. the albumlist of an artist.
+     *
+     * Creates a plan of queries that take their input from the results of other queries,
+     * e.g. albumlist → cover and tracklist of every album → lyrics of every track.
+     * @settings becomes the root stage of the plan (see glyr_plan_root()), and is copied,
+     * including the download callback. Further stages are added by glyr_plan_add_stage().
+     *
+     * Returns: a newly allocated #GlyrPlan, free it with glyr_plan_destroy(), or %NULL if @settings is not initialized.
+     */
+    GlyrPlan * glyr_plan_new (GlyrQuery * settings);
+
+    /**
+     * glyr_plan_root:
+     * @plan: A plan created by glyr_plan_new()
+     *
+     * Returns: the stage running the query passed to glyr_plan_new()
+     */
+    GlyrPlanStage * glyr_plan_root (GlyrPlan * plan);
+
+    /**
+     * glyr_plan_add_stage:
+     * @plan: A plan created by glyr_plan_new()
+     * @parent: The stage whose results are the input of the new stage
+     * @type: What the new stage gets
+     * @number: Max. number of items to get per query, 0 -> inf
+     *
+     * For every item the @parent stage finds, a query of @type is started.
+     * It has the same settings as the query that found the item, but with the item filled in:
+     * <itemizedlist>
+     * <listitem><para>GLYR_TYPE_ALBUMLIST: the album name</para></listitem>
+     * <listitem><para>GLYR_TYPE_TRACK: the title</para></listitem>
+     * <listitem><para>GLYR_TYPE_SIMILAR_ARTIST: the artist</para></listitem>
+     * <listitem><para>GLYR_TYPE_SIMILAR_SONG: artist and title</para></listitem>
+     * </itemizedlist>
+     * Items of other types carry no input, so then one query is started if the parent found anything.
+     *
+     * Returns: the new stage, or %NULL on bad arguments.
+     */
+    GlyrPlanStage * glyr_plan_add_stage (GlyrPlan * plan, GlyrPlanStage * parent, GLYR_GET_TYPE type, unsigned int number);
+
+    /**
+     * glyr_plan_execute:
+     * @plan: A plan created by glyr_plan_new()
+     *
+     * Runs all queries of the plan and returns once all are done.
+     * Queries are started as soon as the item they depend on was found,
+     * and run in parallel (but still share the transfer limits of glyr_get()),
+     * so the plan takes about as long as its longest chain of stages, not as long as
+     * all of its queries together.
+     *
+     * Found items are passed to the download callback of the query passed to glyr_plan_new();
+     * the #GlyrQuery passed to it tells what item it was searched for.
+     * Returning GLYRE_SKIP there also means that no child queries are started for this item.
+     *
+     * <note>
+     * <para>
+     * The callback is called from several threads at once.
+     * </para>
+     * </note>
+     *
+     * Returns: GLYRE_OK, or GLYRE_WAS_STOPPED if glyr_plan_stop() was called.
+     */
+    GLYR_ERROR glyr_plan_execute (GlyrPlan * plan);
+
+    /**
+     * glyr_plan_stop:
+     * @plan: A plan created by glyr_plan_new()
+     *
+     * Stops a running glyr_plan_execute() as soon as possible. May be called from any thread.
+     */
+    void glyr_plan_stop (GlyrPlan * plan);
+
+    /**
+     * glyr_plan_destroy:
+     * @plan: A plan created by glyr_plan_new()
+     *
+     * Frees the plan and all of its stages. The plan may not be executing anymore.
+     */
+    void glyr_plan_destroy (GlyrPlan * plan);
+
     /**
      * glyr_query_init:
      * @query: The GlyrQuery to initialize to defaultsettings.
@@ -268,6 +379,23 @@ extern "C"
     */
     void glyr_cache_print (GlyrMemCache * cache);
 
+    /**
+    * glyr_cache_materialize:
+    * @list: A list returned by glyr_get() with glyr_opt_download() set to false.
+    * @n: How many items to look at, starting with @list; 0 means all.
+    * @s: The query that delivered @list, for timeout, proxy and the like. May be %NULL.
+    *
+    * Downloads the images of the first @n items of @list that are still URLs (type GLYR_TYPE_IMG_URL),
+    * all at the same time, and replaces the URL in each of them by the image.
+    * The items keep their provider and score, and get the image type of the query (e.g. GLYR_TYPE_COVERART).
+    * Items that are images already, or whose download fails, are left as they are.
+    *
+    * This way a list of candidates can be shown first, and only the images the user looks at are downloaded.
+    *
+    * Returns: The number of items that are images now, but weren't before.
+    */
+    int glyr_cache_materialize (GlyrMemCache * list, int n, GlyrQuery * s);
+
     /********************************************************
     * GlyOpt methods ahead - use them to control glyr_get() *
     ********************************************************/
@@ -459,6 +587,7 @@ extern "C"
     * @parallel_jobs: The number of providers that are queried in parallel.
     *
     * A value of 0 lets libglyr chooses this value itself. This is the default.
+    * Transfers of all queries in a process share 32 slots, see glyr_opt_priority().
     *
     * Returns: an error ID
     */
@@ -783,7 +912,9 @@ extern "C"
     * Bind the previosly created @db to the query @s.
     * By doing this you add a new 'local' provider,
     * that is queried before everything else and may speed up
-    * things heavily.
+    * things heavily. If the database already holds enough items
+    * no other provider is queried at all, otherwise only the missing
+    * items are searched online.
     *
     * You can either query it exclusively or disable it completely:
     *
@@ -919,6 +1050,88 @@ extern "C"
      */
     GLYR_ERROR glyr_opt_normalize (GlyrQuery * s, GLYR_NORMALIZATION norm);
 
+    /**
+     * glyr_opt_priority:
+     * @s: The GlyrQuery settings struct to store this option in.
+     * @priority: A member of #GLYR_PRIORITY
+     *
+     * All queries running in one process share a fixed number of transfer slots:
+     * at most 32 transfers run at the same time, whatever the priority of the queries is;
+     * further ones wait for a slot. This limits many parallel interactive queries too.
+     * Interactive queries are served first and may take the slots of background
+     * transfers that did not receive any data yet (only as many as they wait for);
+     * those get restarted later, but still time out after glyr_opt_timeout() from their first start.
+     * Background queries never use the slots reserved for interactive ones and
+     * wait as long as an interactive query waits for a slot.
+     *
+     * Use GLYR_PRIORITY_BACKGROUND for bulk jobs like scanning a whole library,
+     * so they do not slow down lookups a user is waiting for.
+     *
+     * <note>
+     * <para>
+     * This may be changed while the query is running, e.g. from another thread.
+     * The default is GLYR_PRIORITY_INTERACTIVE
+     * </para>
+     * </note>
+     *
+     * Returns: an error ID
+     */
+    GLYR_ERROR glyr_opt_priority (GlyrQuery * s, GLYR_PRIORITY priority);
+
+    /**
+     * glyr_opt_autotune:
+     * @s: The GlyrQuery settings struct to store this option in.
+     * @autotune: Boolean, true to let libglyr learn parallel and timeouts.
+     *
+     * libglyr watches how long transfers take and how many of the queried providers
+     * actually deliver something, separately for every get type.
+     * If enabled, this is used to choose the number of providers that are queried at once
+     * (if glyr_opt_parallel() is left at 0), so that one wave most likely yields a result
+     * without asking providers needlessly. The transfer timeout of every provider is lowered
+     * to the time almost all of its transfers took; transfers running into that timeout raise
+     * it again. The value of glyr_opt_timeout() is always the upper limit.
+     *
+     * Until enough queries of a type were done, the usual defaults are used.
+     *
+     * Returns: an error ID
+     */
+    GLYR_ERROR glyr_opt_autotune (GlyrQuery * s, bool autotune);
+
+    /**
+     * glyr_opt_img_dedup:
+     * @s: The GlyrQuery settings struct to store this option in.
+     * @img_dedup: Boolean, true to drop images that look like already found ones.
+     *
+     * The same cover is often delivered by several providers, in different sizes or jpeg qualities,
+     * so the checksums differ. If enabled, downloaded images are compared by their look
+     * and only one of each is returned, the one with the highest resolution.
+     * If a later copy has a higher resolution, it replaces the one found before in the results;
+     * the download callback has seen both then. Other sizes of an image whose URL tells
+     * the size (like last.fm's) are not downloaded if a larger one was already started.
+     *
+     * This only has an effect if images are downloaded (see glyr_opt_download()),
+     * and libglyr was built with gdk-pixbuf.
+     *
+     * Returns: an error ID
+     */
+    GLYR_ERROR glyr_opt_img_dedup (GlyrQuery * s, bool img_dedup);
+
+    /**
+     * glyr_opt_confidence:
+     * @s: The GlyrQuery settings struct to store this option in.
+     * @threshold: A score from 0.0 to 1.0, 0.0 disables early termination (default).
+     *
+     * Every item gets a score (see the score field of #GlyrMemCache), built from the quality of
+     * the provider and how well the artist/album/title it found matches the query;
+     * images also count their size. Results are always returned best first.
+     *
+     * If a threshold is set, no further providers are asked once an item scores at least this much,
+     * even if less than glyr_opt_number() items were found. Items from the local cache score 1.0.
+     *
+     * Returns: an error ID, GLYRE_BAD_VALUE if threshold is not in [0.0,1.0]
+     */
+    GLYR_ERROR glyr_opt_confidence (GlyrQuery * s, float threshold);
+
     /**
     * glyr_download:
     * @url: A valid url, for example returned by libglyr
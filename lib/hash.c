@@ -0,0 +1,131 @@
+/***********************************************************
+ * This file is part of glyr
+ * + a commnadline tool and library to download various sort of music related metadata.
+ * + Copyright (C) [2011]  [Christopher Pahl]
+ * + Hosted at: https://github.com/sahib/glyr
+ *
+ * glyr is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * glyr is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with glyr. If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************/
+
+/* MurmurHash3_x64_128, written by Austin Appleby and placed in the public domain.
+ * Blocks are read with memcpy() in host byte order, so unaligned data is fine,
+ * but hashes differ between little and big endian hosts - they are never stored.
+ */
+
+#include "hash.h"
+#include <string.h>
+
+#define ROTL64(X,R) (((X) << (R)) | ((X) >> (64 - (R))))
+
+/////////////////////////////////
+
+static inline guint64 fmix64 (guint64 k)
+{
+    k ^= k >> 33;
+    k *= G_GUINT64_CONSTANT (0xff51afd7ed558ccd);
+    k ^= k >> 33;
+    k *= G_GUINT64_CONSTANT (0xc4ceb9fe1a85ec53);
+    k ^= k >> 33;
+    return k;
+}
+
+/////////////////////////////////
+
+void content_hash (const void * data, gsize size, guchar * out)
+{
+    const guchar * bytes = data;
+    const gsize nblocks = size / 16;
+
+    const guint64 c1 = G_GUINT64_CONSTANT (0x87c37b91114253d5);
+    const guint64 c2 = G_GUINT64_CONSTANT (0x4cf5ad432745937f);
+
+    guint64 h1 = 0;
+    guint64 h2 = 0;
+
+    /* Body */
+    for (gsize i = 0; i < nblocks; i++)
+    {
+        guint64 k1, k2;
+        memcpy (&k1,bytes + i * 16 + 0,8);
+        memcpy (&k2,bytes + i * 16 + 8,8);
+
+        k1 *= c1;
+        k1  = ROTL64 (k1,31);
+        k1 *= c2;
+        h1 ^= k1;
+
+        h1  = ROTL64 (h1,27);
+        h1 += h2;
+        h1  = h1 * 5 + 0x52dce729;
+
+        k2 *= c2;
+        k2  = ROTL64 (k2,33);
+        k2 *= c1;
+        h2 ^= k2;
+
+        h2  = ROTL64 (h2,31);
+        h2 += h1;
+        h2  = h2 * 5 + 0x38495ab5;
+    }
+
+    /* Tail */
+    const guchar * tail = bytes + nblocks * 16;
+    guint64 k1 = 0;
+    guint64 k2 = 0;
+
+    const gsize rest = size & 15;
+    for (gsize i = rest; i > 8; i--)
+    {
+        k2 ^= ( (guint64) tail[i - 1]) << ( (i - 9) * 8);
+    }
+
+    if (rest > 8)
+    {
+        k2 *= c2;
+        k2  = ROTL64 (k2,33);
+        k2 *= c1;
+        h2 ^= k2;
+    }
+
+    for (gsize i = MIN (rest,8); i > 0; i--)
+    {
+        k1 ^= ( (guint64) tail[i - 1]) << ( (i - 1) * 8);
+    }
+
+    if (rest > 0)
+    {
+        k1 *= c1;
+        k1  = ROTL64 (k1,31);
+        k1 *= c2;
+        h1 ^= k1;
+    }
+
+    /* Finalization */
+    h1 ^= size;
+    h2 ^= size;
+
+    h1 += h2;
+    h2 += h1;
+
+    h1 = fmix64 (h1);
+    h2 = fmix64 (h2);
+
+    h1 += h2;
+    h2 += h1;
+
+    memcpy (out + 0,&h1,8);
+    memcpy (out + 8,&h2,8);
+}
+
+/////////////////////////////////
@@ -0,0 +1,34 @@
+/***********************************************************
+ * This file is part of glyr
+ * + a commnadline tool and library to download various sort of music related metadata.
+ * + Copyright (C) [2011]  [Christopher Pahl]
+ * + Hosted at: https://github.com/sahib/glyr
+ *
+ * glyr is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * glyr is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with glyr. If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************/
+
+#ifndef GLYR_HASH_H
+#define GLYR_HASH_H
+
+#include <glib.h>
+
+/* Size of a content hash in bytes */
+#define CONTENT_HASH_SIZE 16
+
+/* Fast, non-cryptographic 128 bit hash (MurmurHash3, x64 variant).
+ * Used to compare items internally; md5sum is only built for items handed out.
+ */
+void content_hash (const void * data, gsize size, guchar * out);
+
+#endif
@@ -0,0 +1,203 @@
+/***********************************************************
+ * This file is part of glyr
+ * + a commnadline tool and library to download various sort of music related metadata.
+ * + Copyright (C) [2011]  [Christopher Pahl]
+ * + Hosted at: https://github.com/sahib/glyr
+ *
+ * glyr is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * glyr is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with glyr. If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************/
+
+/* Perceptual duplicate check for images.
+ * The same cover from several providers differs in size and jpeg quality,
+ * so checksums don't help - instead every image is shrinked to 9x8 gray pixels,
+ * and the 64 "is brighter than the right neighbour" bits are compared (dHash).
+ * Decoding needs gdk-pixbuf; without it no image counts as duplicate.
+ */
+
+#include "imghash.h"
+#include "core.h"
+
+#ifdef GLYR_HAVE_PIXBUF
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#endif
+
+/* Images are decoded to about this size, jpegs are scaled down while decoding */
+#define IMGHASH_DECODE_SIZE 64
+
+/////////////////////////////////
+
+typedef struct
+{
+    guint64 hash;
+    gint pixels;
+    GlyrMemCache * cache;
+
+} ImageEntry;
+
+/////////////////////////////////
+
+#ifdef GLYR_HAVE_PIXBUF
+
+static void on_size_prepared (GdkPixbufLoader * loader, gint width, gint height, gpointer pixels)
+{
+    * (gint *) pixels = width * height;
+    gdk_pixbuf_loader_set_size (loader,IMGHASH_DECODE_SIZE,IMGHASH_DECODE_SIZE);
+}
+
+#endif
+
+/////////////////////////////////
+
+static gboolean image_dhash (GlyrMemCache * cache, guint64 * hash, gint * pixels)
+{
+    gboolean result = FALSE;
+#ifdef GLYR_HAVE_PIXBUF
+    if (cache->data == NULL || cache->size == 0)
+    {
+        return FALSE;
+    }
+
+    GdkPixbufLoader * loader = gdk_pixbuf_loader_new();
+    g_signal_connect (loader,"size-prepared",G_CALLBACK (on_size_prepared),pixels);
+
+    gboolean decoded = gdk_pixbuf_loader_write (loader, (const guchar *) cache->data,cache->size,NULL);
+    decoded = gdk_pixbuf_loader_close (loader,NULL) && decoded;
+
+    GdkPixbuf * image = (decoded) ? gdk_pixbuf_loader_get_pixbuf (loader) : NULL;
+    GdkPixbuf * thumb = (image) ? gdk_pixbuf_scale_simple (image,9,8,GDK_INTERP_BILINEAR) : NULL;
+    if (thumb != NULL)
+    {
+        const guchar * row = gdk_pixbuf_get_pixels (thumb);
+        gint stride = gdk_pixbuf_get_rowstride (thumb);
+        gint channels = gdk_pixbuf_get_n_channels (thumb);
+
+        *hash = 0;
+        for (gint y = 0; y < 8; y++, row += stride)
+        {
+            gint left = -1;
+            for (gint x = 0; x < 9; x++)
+            {
+                const guchar * px = row + x * channels;
+                gint gray = (px[0] * 299 + px[1] * 587 + px[2] * 114) / 1000;
+                if (left >= 0)
+                {
+                    *hash = (*hash << 1) | (left > gray);
+                }
+                left = gray;
+            }
+        }
+
+        g_object_unref (thumb);
+        result = TRUE;
+    }
+    g_object_unref (loader);
+#else
+    (void) cache;
+    (void) hash;
+    (void) pixels;
+#endif
+    return result;
+}
+
+/////////////////////////////////
+
+static gint hamming_distance (guint64 a, guint64 b)
+{
+    gint bits = 0;
+    for (guint64 diff = a ^ b; diff != 0; diff &= diff - 1)
+    {
+        bits++;
+    }
+    return bits;
+}
+
+/////////////////////////////////
+
+gboolean image_set_merge (GlyrQuery * s, GlyrMemCache * cache, GlyrMemCache ** smaller)
+{
+    *smaller = NULL;
+
+    RunState * state = s->run_state;
+    if (state == NULL || s->img_dedup == FALSE || cache == NULL)
+    {
+        return FALSE;
+    }
+
+    ImageEntry entry = {0, 0, cache};
+    if (image_dhash (cache,&entry.hash,&entry.pixels) == FALSE)
+    {
+        return FALSE;
+    }
+
+    if (state->images == NULL)
+    {
+        state->images = g_array_new (FALSE,FALSE,sizeof (ImageEntry) );
+    }
+
+    for (guint i = 0; i < state->images->len; i++)
+    {
+        ImageEntry * other = &g_array_index (state->images,ImageEntry,i);
+        if (hamming_distance (other->hash,entry.hash) <= IMGHASH_MAX_DISTANCE)
+        {
+            glyr_message (2,s,"- Image from %s looks like the one from %s, keeping the larger one\n",
+                          cache->dsrc ? cache->dsrc : "?",
+                          other->cache->dsrc ? other->cache->dsrc : "?");
+
+            if (entry.pixels <= other->pixels)
+            {
+                return TRUE;
+            }
+
+            /* The accepted one was handed out already, so it is replaced as a whole */
+            *smaller = other->cache;
+            *other = entry;
+            return FALSE;
+        }
+    }
+
+    g_array_append_val (state->images,entry);
+    return FALSE;
+}
+
+/////////////////////////////////
+
+void image_set_forget (GlyrQuery * s, GlyrMemCache * cache)
+{
+    RunState * state = s->run_state;
+    if (state != NULL && state->images != NULL)
+    {
+        for (guint i = 0; i < state->images->len; i++)
+        {
+            if (g_array_index (state->images,ImageEntry,i).cache == cache)
+            {
+                g_array_remove_index_fast (state->images,i);
+                break;
+            }
+        }
+    }
+}
+
+/////////////////////////////////
+
+void image_set_free (GlyrQuery * s)
+{
+    RunState * state = s->run_state;
+    if (state != NULL && state->images != NULL)
+    {
+        g_array_free (state->images,TRUE);
+        state->images = NULL;
+    }
+}
+
+/////////////////////////////////
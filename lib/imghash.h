@@ -0,0 +1,43 @@
+/***********************************************************
+ * This file is part of glyr
+ * + a commnadline tool and library to download various sort of music related metadata.
+ * + Copyright (C) [2011]  [Christopher Pahl]
+ * + Hosted at: https://github.com/sahib/glyr
+ *
+ * glyr is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * glyr is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with glyr. If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************/
+
+#ifndef GLYR_IMGHASH_H
+#define GLYR_IMGHASH_H
+
+#include "types.h"
+#include <glib.h>
+
+/* Max. number of differing bits of two dHashes showing the same image */
+#define IMGHASH_MAX_DISTANCE 6
+
+/* Compare cache to the images accepted in this run, if glyr_opt_img_dedup() is set.
+ * Returns TRUE if it shows the same as one of them with at least the resolution of cache,
+ * cache should be dropped then. Otherwise cache is remembered as accepted; if it shows
+ * the same as a smaller accepted one, that one is set to *smaller and should be dropped instead.
+ */
+gboolean image_set_merge (GlyrQuery * s, GlyrMemCache * cache, GlyrMemCache ** smaller);
+
+/* Forget cache again, e.g. because the user skipped it */
+void image_set_forget (GlyrQuery * s, GlyrMemCache * cache);
+
+/* Called at the end of a run */
+void image_set_free (GlyrQuery * s);
+
+#endif
@@ -21,12 +21,12 @@
 #include "generic.h"
 #include "../core.h"
 #include "../stringlib.h"
+#include "../imghash.h"
 
 struct callback_save_struct
 {
     GHashTable * table;
     GLYR_DATA_TYPE type;
-    GList * results;
 };
 
 /////////////////////////////////
@@ -39,7 +39,7 @@ GList * generic_txt_finalizer (GlyrQuery * settings, GList * input_list, gboolea
     for (GList * elem = input_list; elem; elem = elem->next)
     {
         GlyrMemCache * item = elem->data;
-        if (is_in_result_list (item,result_list[0]) == FALSE && add_to_list == TRUE)
+        if (add_to_list == TRUE && result_set_add (settings,item) == TRUE)
         {
             /* Set to some default type */
             if (item->type == GLYR_TYPE_UNKNOWN)
@@ -47,6 +47,9 @@ GList * generic_txt_finalizer (GlyrQuery * settings, GList * input_list, gboolea
                 item->type = type;
             }
 
+            /* Only needed for items handed out */
+            update_md5sum (item);
+
             /* call user defined callback */
             GLYR_ERROR response = GLYRE_OK;
             if (settings->callback.download)
@@ -73,7 +76,7 @@ GList * generic_txt_finalizer (GlyrQuery * settings, GList * input_list, gboolea
         }
         else
         {
-            settings->itemctr--;
+            ADD_ATOMIC_ITEMCTR (settings,-1);
             DL_free (item);
             item = NULL;
         }
@@ -95,37 +98,9 @@ static GList * async_dl_callback (cb_object * capo, void * userptr, bool * stop_
         if (prov_url_table != NULL)
         {
             GlyrMemCache * old_cache = g_hash_table_lookup (prov_url_table,capo->cache->dsrc);
-            GLYR_ERROR response = GLYRE_OK;
             if (old_cache != NULL)
             {
-                update_md5sum (capo->cache);
-                if (is_in_result_list (capo->cache,saver->results) == FALSE)
-                {
-                    capo->cache->prov       = (old_cache->prov!=NULL) ? g_strdup (old_cache->prov) : NULL;
-                    capo->cache->img_format = (old_cache->img_format) ? g_strdup (old_cache->img_format) : NULL;
-
-                    if (capo->cache->type == GLYR_TYPE_UNKNOWN)
-                    {
-                        capo->cache->type = saver->type;
-                    }
-
-                    if (capo->s->callback.download != NULL)
-                    {
-                        response = capo->s->callback.download (capo->cache,capo->s);
-                    }
-
-                    *add_item = (response != GLYRE_SKIP && response != GLYRE_STOP_PRE);
-                }
-                else
-                {
-                    capo->s->itemctr--;
-                    *add_item = FALSE;
-                }
-            }
-
-            if (response == GLYRE_STOP_POST || response == GLYRE_STOP_PRE)
-            {
-                *stop_download = TRUE;
+                *add_item = accept_image (capo->s,capo->cache,old_cache,saver->type,stop_download);
             }
         }
         else
@@ -155,6 +130,9 @@ GList * generic_img_finalizer (GlyrQuery * s, GList * list, gboolean * stop_me,
         /* Convert to a list of URLs first */
         GList * url_list  = NULL;
 
+        /* Most images were downloaded while the providers were still searching */
+        GList * ready_images = NULL;
+
         /* Hashtable to associate the provider name with the corresponding URL */
         GHashTable * cache_url_table = g_hash_table_new_full (g_str_hash,g_str_equal,
                                        NULL,
@@ -165,6 +143,11 @@ GList * generic_img_finalizer (GlyrQuery * s, GList * list, gboolean * stop_me,
         for (GList * item = list; item; item = item->next)
         {
             GlyrMemCache * cache = item->data;
+            if (cache->is_image == true)
+            {
+                ready_images = g_list_prepend (ready_images,cache);
+                continue;
+            }
 
             /* Make a copy, since we free the cache */
             gchar * url_double = g_strdup (cache->data);
@@ -178,12 +161,12 @@ GList * generic_img_finalizer (GlyrQuery * s, GList * list, gboolean * stop_me,
         struct callback_save_struct userptr =
         {
             .table = cache_url_table,
-            .type  = type,
-            .results = result_list ? result_list[0] : NULL
+            .type  = type
         };
 
         /* Download images in parallel */
-        GList * dl_raw_images = async_download (url_list,NULL,s,1, (g_list_length (url_list) /2),async_dl_callback,&userptr,FALSE);
+        GList * dl_raw_images = async_download (url_list,NULL,s,1, (g_list_length (url_list) /2),NULL,async_dl_callback,&userptr,FALSE);
+        dl_raw_images = g_list_concat (g_list_reverse (ready_images),dl_raw_images);
 
         /* Default to the given type */
         for (GList * elem = dl_raw_images; elem; elem = elem->next)
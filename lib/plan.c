@@ -0,0 +1,321 @@
+/***********************************************************
+ * This file is part of glyr
+ * + a commnadline tool and library to download various sort of music related metadata.
+ * + Copyright (C) [2011]  [Christopher Pahl]
+ * + Hosted at: https://github.com/sahib/glyr
+ *
+ * glyr is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * glyr is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with glyr. If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************/
+
+/* Plans: queries whose input comes from the results of other queries,
+ * e.g. albumlist -> cover of every album. Every query of a plan runs
+ * as soon as the item it depends on is there, so a whole plan takes
+ * about as long as the deepest chain of queries in it.
+ */
+
+#include "glyr.h"
+#include "core.h"
+#include "prefetch.h"
+
+/* Max. number of queries of one plan running at the same time */
+#define GLYR_PLAN_THREADS 8
+
+/////////////////////////////////
+
+struct _GlyrPlanStage
+{
+    GLYR_GET_TYPE type;
+    gint number;
+
+    /* Stages fed by the results of this one */
+    GList * children;
+};
+
+struct _GlyrPlan
+{
+    GlyrQuery * query;
+    GlyrPlanStage * root;
+
+    /* All stages, for freeing */
+    GList * stages;
+
+    /* Only valid during glyr_plan_execute() */
+    GMutex lock;
+    GCond done;
+    GThreadPool * pool;
+    GList * running;
+    gint pending;
+    gint stopped;
+};
+
+typedef struct
+{
+    GlyrPlan * plan;
+    GlyrPlanStage * stage;
+    GlyrQuery * query;
+
+} PlanTask;
+
+/////////////////////////////////
+
+static GlyrPlanStage * stage_new (GlyrPlan * plan, GLYR_GET_TYPE type, gint number)
+{
+    GlyrPlanStage * stage = g_malloc0 (sizeof (GlyrPlanStage) );
+    stage->type = type;
+    stage->number = number;
+    plan->stages = g_list_prepend (plan->stages,stage);
+    return stage;
+}
+
+/////////////////////////////////
+
+/* Fill in the fields of query that item tells about.
+ * Returns FALSE if the item says nothing the parent query didn't know already.
+ */
+static gboolean derive_from_item (GlyrQuery * query, GlyrMemCache * item)
+{
+    if (item->data == NULL || item->is_image)
+    {
+        return FALSE;
+    }
+
+    gboolean derived = TRUE;
+    gchar * data = g_strndup (item->data,item->size);
+    gchar ** lines = g_strsplit (data,"\n",-1);
+
+    switch (item->type)
+    {
+    case GLYR_TYPE_ALBUMLIST:
+        glyr_opt_album (query,lines[0]);
+        break;
+    case GLYR_TYPE_TRACK:
+        glyr_opt_title (query,lines[0]);
+        break;
+    case GLYR_TYPE_SIMILAR_ARTIST:
+        /* name\nmatch\nurl\nimages... */
+        glyr_opt_artist (query,lines[0]);
+        break;
+    case GLYR_TYPE_SIMILAR_SONG:
+        /* title\nartist\nmatch\nurl */
+        glyr_opt_title (query,lines[0]);
+        if (lines[0] != NULL && lines[1] != NULL)
+        {
+            glyr_opt_artist (query,lines[1]);
+        }
+        break;
+    default:
+        derived = FALSE;
+        break;
+    }
+
+    g_strfreev (lines);
+    g_free (data);
+    return derived;
+}
+
+/////////////////////////////////
+
+/* Needs plan->lock to be held */
+static void plan_push (GlyrPlan * plan, GlyrPlanStage * stage, GlyrQuery * query)
+{
+    PlanTask * task = g_malloc0 (sizeof (PlanTask) );
+    task->plan = plan;
+    task->stage = stage;
+    task->query = query;
+
+    plan->pending++;
+    g_thread_pool_push (plan->pool,task,NULL);
+}
+
+/////////////////////////////////
+
+static void plan_worker (gpointer data, gpointer user_data)
+{
+    PlanTask * task = data;
+    GlyrPlan * plan = task->plan;
+    GlyrMemCache * results = NULL;
+
+    g_mutex_lock (&plan->lock);
+    gboolean run = (plan->stopped == FALSE);
+    if (run == TRUE)
+    {
+        plan->running = g_list_prepend (plan->running,task->query);
+    }
+    g_mutex_unlock (&plan->lock);
+
+    if (run == TRUE)
+    {
+        results = glyr_get (task->query,NULL,NULL);
+    }
+
+    g_mutex_lock (&plan->lock);
+    plan->running = g_list_remove (plan->running,task->query);
+
+    /* Feed every child stage - the next level starts right now, not after this one */
+    for (GList * elem = task->stage->children; elem && plan->stopped == FALSE; elem = elem->next)
+    {
+        GlyrPlanStage * child = elem->data;
+        for (GlyrMemCache * item = results; item != NULL; item = item->next)
+        {
+            GlyrQuery * query = query_copy (task->query);
+            gboolean per_item = derive_from_item (query,item);
+
+            query->type = child->type;
+            query->number = child->number;
+            query->callback = task->query->callback;
+            plan_push (plan,child,query);
+
+            /* Nothing new to search for with the other items */
+            if (per_item == FALSE)
+            {
+                break;
+            }
+        }
+    }
+
+    if (--plan->pending == 0)
+    {
+        g_cond_broadcast (&plan->done);
+    }
+    g_mutex_unlock (&plan->lock);
+
+    glyr_free_list (results);
+    glyr_query_destroy (task->query);
+    g_free (task->query);
+    g_free (task);
+}
+
+/////////////////////////////////
+
+__attribute__ ( (visibility ("default") ) )
+GlyrPlan * glyr_plan_new (GlyrQuery * query)
+{
+    if (query == NULL || QUERY_IS_INITALIZED (query) == FALSE)
+    {
+        return NULL;
+    }
+
+    GlyrPlan * plan = g_malloc0 (sizeof (GlyrPlan) );
+    plan->query = query_copy (query);
+    plan->query->callback = query->callback;
+    plan->root = stage_new (plan,query->type,query->number);
+    g_mutex_init (&plan->lock);
+    g_cond_init (&plan->done);
+    return plan;
+}
+
+/////////////////////////////////
+
+__attribute__ ( (visibility ("default") ) )
+GlyrPlanStage * glyr_plan_root (GlyrPlan * plan)
+{
+    return (plan != NULL) ? plan->root : NULL;
+}
+
+/////////////////////////////////
+
+__attribute__ ( (visibility ("default") ) )
+GlyrPlanStage * glyr_plan_add_stage (GlyrPlan * plan, GlyrPlanStage * parent, GLYR_GET_TYPE type, unsigned int number)
+{
+    if (plan == NULL || parent == NULL || type <= GLYR_GET_UNKNOWN || type >= GLYR_GET_ANY)
+    {
+        return NULL;
+    }
+
+    GlyrPlanStage * stage = stage_new (plan,type,number == 0 ? G_MAXINT : (gint) number);
+    parent->children = g_list_append (parent->children,stage);
+    return stage;
+}
+
+/////////////////////////////////
+
+__attribute__ ( (visibility ("default") ) )
+GLYR_ERROR glyr_plan_execute (GlyrPlan * plan)
+{
+    if (plan == NULL)
+    {
+        return GLYRE_EMPTY_STRUCT;
+    }
+
+    GError * error = NULL;
+    GThreadPool * pool = g_thread_pool_new (plan_worker,NULL,GLYR_PLAN_THREADS,FALSE,&error);
+    if (pool == NULL)
+    {
+        glyr_message (-1,NULL,"glyr_plan_execute: %s\n",error ? error->message : "no threads");
+        g_clear_error (&error);
+        return GLYRE_UNKNOWN;
+    }
+
+    g_mutex_lock (&plan->lock);
+    plan->pool = pool;
+    plan->stopped = FALSE;
+
+    GlyrQuery * root = query_copy (plan->query);
+    root->callback = plan->query->callback;
+    plan_push (plan,plan->root,root);
+
+    while (plan->pending > 0)
+    {
+        g_cond_wait (&plan->done,&plan->lock);
+    }
+
+    plan->pool = NULL;
+    gboolean stopped = plan->stopped;
+    g_mutex_unlock (&plan->lock);
+
+    g_thread_pool_free (pool,FALSE,TRUE);
+    return (stopped) ? GLYRE_WAS_STOPPED : GLYRE_OK;
+}
+
+/////////////////////////////////
+
+__attribute__ ( (visibility ("default") ) )
+void glyr_plan_stop (GlyrPlan * plan)
+{
+    if (plan != NULL)
+    {
+        g_mutex_lock (&plan->lock);
+        plan->stopped = TRUE;
+        for (GList * elem = plan->running; elem; elem = elem->next)
+        {
+            glyr_signal_exit (elem->data);
+        }
+        g_mutex_unlock (&plan->lock);
+    }
+}
+
+/////////////////////////////////
+
+__attribute__ ( (visibility ("default") ) )
+void glyr_plan_destroy (GlyrPlan * plan)
+{
+    if (plan != NULL)
+    {
+        for (GList * elem = plan->stages; elem; elem = elem->next)
+        {
+            GlyrPlanStage * stage = elem->data;
+            g_list_free (stage->children);
+            g_free (stage);
+        }
+        g_list_free (plan->stages);
+
+        glyr_query_destroy (plan->query);
+        g_free (plan->query);
+        g_mutex_clear (&plan->lock);
+        g_cond_clear (&plan->done);
+        g_free (plan);
+    }
+}
+
+/////////////////////////////////
@@ -0,0 +1,382 @@
+/***********************************************************
+ * This file is part of glyr
+ * + a commnadline tool and library to download various sort of music related metadata.
+ * + Copyright (C) [2011]  [Christopher Pahl]
+ * + Hosted at: https://github.com/sahib/glyr
+ *
+ * glyr is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * glyr is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with glyr. If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************/
+
+/* Background prefetching, and the bookkeeping of what is currently searched,
+ * so a prefetch and a glyr_get() for the same item don't search twice.
+ */
+
+#include "prefetch.h"
+#include "glyr.h"
+#include "core.h"
+
+/////////////////////////////////
+
+/* One key that is currently searched */
+typedef struct
+{
+    gchar * key;
+    GlyrDatabase * db;
+
+    /* Query of the prefetch job, NULL if started by glyr_get() */
+    GlyrQuery * job;
+
+    /* Set once a worker picked up the job, or somebody took it over */
+    gboolean started;
+    gboolean cancelled;
+
+    /* Set once the job searched everything and wrote its results */
+    gboolean finished;
+
+    /* Queries searching under this key, and everyone holding a pointer */
+    gint runners;
+    gint refs;
+
+} Inflight;
+
+/////////////////////////////////
+
+static GMutex inflight_lock;
+static GCond inflight_cond;
+static GHashTable * inflight_table = NULL;
+
+static GThreadPool * prefetch_pool = NULL;
+static gint shutting_down = FALSE;
+
+/////////////////////////////////
+
+GlyrQuery * query_copy (GlyrQuery * src)
+{
+    GlyrQuery * copy = g_malloc0 (sizeof (GlyrQuery) );
+    glyr_query_init (copy);
+
+    copy->type = src->type;
+    copy->number = src->number;
+    copy->plugmax = src->plugmax;
+    copy->verbosity = src->verbosity;
+    copy->fuzzyness = src->fuzzyness;
+    copy->img_min_size = src->img_min_size;
+    copy->img_max_size = src->img_max_size;
+    copy->parallel = src->parallel;
+    copy->timeout = src->timeout;
+    copy->redirects = src->redirects;
+    copy->force_utf8 = src->force_utf8;
+    copy->download = src->download;
+    copy->qsratio = src->qsratio;
+    copy->normalization = src->normalization;
+    copy->db_autoread = src->db_autoread;
+    copy->db_autowrite = src->db_autowrite;
+    copy->local_db = src->local_db;
+    copy->lang_aware_only = src->lang_aware_only;
+    copy->priority = GET_ATOMIC_PRIORITY (src);
+    copy->autotune = src->autotune;
+    copy->img_dedup = src->img_dedup;
+    copy->confidence = src->confidence;
+
+    /* Those do nothing on NULL */
+    glyr_opt_artist (copy,src->artist);
+    glyr_opt_album (copy,src->album);
+    glyr_opt_title (copy,src->title);
+    glyr_opt_proxy (copy,src->proxy);
+    glyr_opt_from (copy,src->from);
+    glyr_opt_allowed_formats (copy,src->allowed_formats);
+    glyr_opt_useragent (copy,src->useragent);
+    glyr_opt_lang (copy,src->lang);
+    glyr_opt_musictree_path (copy,src->musictree_path);
+
+    return copy;
+}
+
+/////////////////////////////////
+
+static gchar * build_key (GlyrQuery * query)
+{
+    gchar * artist = (query->artist) ? g_utf8_strdown (query->artist,-1) : NULL;
+    gchar * album  = (query->album)  ? g_utf8_strdown (query->album, -1) : NULL;
+    gchar * title  = (query->title)  ? g_utf8_strdown (query->title, -1) : NULL;
+
+    gchar * key = g_strdup_printf ("%p|%d|%s|%s|%s",
+                                   (void *) query->local_db,
+                                   query->type,
+                                   (artist) ? artist : "",
+                                   (album)  ? album  : "",
+                                   (title)  ? title  : "");
+    g_free (artist);
+    g_free (album);
+    g_free (title);
+    return key;
+}
+
+/////////////////////////////////
+
+/* Both need inflight_lock to be held */
+static void inflight_unref (Inflight * entry)
+{
+    if (--entry->refs == 0)
+    {
+        g_free (entry->key);
+        g_free (entry);
+    }
+}
+
+static void inflight_finish (Inflight * entry)
+{
+    if (--entry->runners == 0)
+    {
+        if (g_hash_table_lookup (inflight_table,entry->key) == entry)
+        {
+            g_hash_table_remove (inflight_table,entry->key);
+        }
+        g_cond_broadcast (&inflight_cond);
+    }
+    inflight_unref (entry);
+}
+
+/////////////////////////////////
+
+static Inflight * inflight_new (gchar * key, GlyrQuery * query, GlyrQuery * job)
+{
+    Inflight * entry = g_malloc0 (sizeof (Inflight) );
+    entry->key = key;
+    entry->db = query->local_db;
+    entry->job = job;
+    entry->runners = 1;
+    entry->refs = 1;
+
+    if (inflight_table == NULL)
+    {
+        inflight_table = g_hash_table_new (g_str_hash,g_str_equal);
+    }
+
+    g_hash_table_insert (inflight_table,entry->key,entry);
+    return entry;
+}
+
+/////////////////////////////////
+
+static void prefetch_worker (gpointer data, gpointer user_data)
+{
+    Inflight * entry = data;
+    GlyrQuery * job = entry->job;
+
+    g_mutex_lock (&inflight_lock);
+    gboolean skip = entry->cancelled;
+    entry->started = TRUE;
+    g_mutex_unlock (&inflight_lock);
+
+    if (skip == FALSE && g_atomic_int_get (&shutting_down) == FALSE)
+    {
+        /* Results get written to the db by glyr_get(), nobody wants them here */
+        GlyrMemCache * results = glyr_get (job,NULL,NULL);
+        glyr_free_list (results);
+    }
+
+    g_mutex_lock (&inflight_lock);
+    entry->finished = (skip == FALSE && g_atomic_int_get (&shutting_down) == FALSE);
+    entry->job = NULL;
+    inflight_finish (entry);
+    g_mutex_unlock (&inflight_lock);
+
+    glyr_query_destroy (job);
+    g_free (job);
+}
+
+/////////////////////////////////
+
+GLYR_ERROR prefetch_schedule (GlyrQuery * query)
+{
+    if (query->local_db == NULL)
+    {
+        return GLYRE_BAD_VALUE;
+    }
+
+    GLYR_ERROR result = GLYRE_OK;
+    gchar * key = build_key (query);
+
+    g_mutex_lock (&inflight_lock);
+    if (inflight_table != NULL && g_hash_table_lookup (inflight_table,key) != NULL)
+    {
+        /* Somebody is already on it */
+        glyr_message (2,query,"- Prefetch: already searching for this item\n");
+        g_free (key);
+    }
+    else
+    {
+        GlyrQuery * job = query_copy (query);
+        job->priority = GLYR_PRIORITY_BACKGROUND;
+        job->db_autowrite = TRUE;
+
+        if (prefetch_pool == NULL)
+        {
+            prefetch_pool = g_thread_pool_new (prefetch_worker,NULL,GLYR_PREFETCH_THREADS,FALSE,NULL);
+        }
+
+        Inflight * entry = inflight_new (key,query,job);
+        if (g_thread_pool_push (prefetch_pool,entry,NULL) == FALSE)
+        {
+            entry->job = NULL;
+            inflight_finish (entry);
+            glyr_query_destroy (job);
+            g_free (job);
+            result = GLYRE_UNKNOWN;
+        }
+    }
+    g_mutex_unlock (&inflight_lock);
+    return result;
+}
+
+/////////////////////////////////
+
+gpointer prefetch_enter (GlyrQuery * query, gboolean * prefetched)
+{
+    *prefetched = FALSE;
+    if (query->local_db == NULL)
+    {
+        return NULL;
+    }
+
+    gchar * key = build_key (query);
+    g_mutex_lock (&inflight_lock);
+
+    Inflight * entry = (inflight_table) ? g_hash_table_lookup (inflight_table,key) : NULL;
+    if (entry != NULL && entry->job == query)
+    {
+        /* That's the prefetch job itself */
+        entry = NULL;
+    }
+    else
+    {
+        if (entry != NULL && entry->job != NULL && entry->started == FALSE)
+        {
+            /* Still queued behind other prefetches - faster to do it ourselves */
+            entry->cancelled = TRUE;
+        }
+        else if (entry != NULL && entry->job != NULL)
+        {
+            /* A prefetch is already on it - let it hurry and wait till it wrote the db */
+            glyr_message (2,query,"- Waiting for running prefetch of this item\n");
+            g_atomic_int_set ( (gint *) &entry->job->priority, GET_ATOMIC_PRIORITY (query) );
+
+            entry->refs++;
+            while (entry->runners > 0 && GET_ATOMIC_SIGNAL_EXIT (query) == FALSE)
+            {
+                g_cond_wait_until (&inflight_cond,&inflight_lock,g_get_monotonic_time () + 100 * G_TIME_SPAN_MILLISECOND);
+            }
+            *prefetched = (entry->runners == 0 && entry->finished == TRUE);
+            inflight_unref (entry);
+
+            entry = (inflight_table) ? g_hash_table_lookup (inflight_table,key) : NULL;
+        }
+
+        if (entry != NULL)
+        {
+            entry->runners++;
+            entry->refs++;
+            g_free (key);
+        }
+        else
+        {
+            entry = inflight_new (key,query,NULL);
+        }
+        key = NULL;
+    }
+
+    g_mutex_unlock (&inflight_lock);
+    g_free (key);
+    return entry;
+}
+
+/////////////////////////////////
+
+void prefetch_leave (gpointer inflight)
+{
+    if (inflight != NULL)
+    {
+        g_mutex_lock (&inflight_lock);
+        inflight_finish (inflight);
+        g_mutex_unlock (&inflight_lock);
+    }
+}
+
+/////////////////////////////////
+
+static gboolean db_has_jobs (GlyrDatabase * db)
+{
+    gboolean has_jobs = FALSE;
+    if (inflight_table != NULL)
+    {
+        GHashTableIter iter;
+        gpointer value = NULL;
+        g_hash_table_iter_init (&iter,inflight_table);
+        while (has_jobs == FALSE && g_hash_table_iter_next (&iter,NULL,&value) )
+        {
+            Inflight * entry = value;
+            has_jobs = (entry->job != NULL && (db == NULL || entry->db == db) );
+        }
+    }
+    return has_jobs;
+}
+
+/////////////////////////////////
+
+void prefetch_drain (GlyrDatabase * db)
+{
+    g_mutex_lock (&inflight_lock);
+    while (db_has_jobs (db) == TRUE)
+    {
+        g_cond_wait_until (&inflight_cond,&inflight_lock,g_get_monotonic_time () + 100 * G_TIME_SPAN_MILLISECOND);
+    }
+    g_mutex_unlock (&inflight_lock);
+}
+
+/////////////////////////////////
+
+void prefetch_shutdown (void)
+{
+    g_mutex_lock (&inflight_lock);
+    GThreadPool * pool = prefetch_pool;
+    prefetch_pool = NULL;
+
+    /* Running jobs should stop as fast as possible, queued ones won't start */
+    g_atomic_int_set (&shutting_down,TRUE);
+    if (inflight_table != NULL)
+    {
+        GHashTableIter iter;
+        gpointer value = NULL;
+        g_hash_table_iter_init (&iter,inflight_table);
+        while (g_hash_table_iter_next (&iter,NULL,&value) )
+        {
+            Inflight * entry = value;
+            if (entry->job != NULL)
+            {
+                SET_ATOMIC_SIGNAL_EXIT (entry->job,1);
+            }
+        }
+    }
+    g_mutex_unlock (&inflight_lock);
+
+    if (pool != NULL)
+    {
+        g_thread_pool_free (pool,FALSE,TRUE);
+    }
+
+    g_atomic_int_set (&shutting_down,FALSE);
+}
+
+/////////////////////////////////
@@ -0,0 +1,48 @@
+/***********************************************************
+ * This file is part of glyr
+ * + a commnadline tool and library to download various sort of music related metadata.
+ * + Copyright (C) [2011]  [Christopher Pahl]
+ * + Hosted at: https://github.com/sahib/glyr
+ *
+ * glyr is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * glyr is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with glyr. If not, see <http://www.gnu.org/licenses/>.
+ **************************************************************/
+
+#ifndef GLYR_PREFETCH_H
+#define GLYR_PREFETCH_H
+
+#include "types.h"
+#include <glib.h>
+
+/* Number of threads working on prefetch jobs */
+#define GLYR_PREFETCH_THREADS 2
+
+/* Deep copy of a query, without the download callback */
+GlyrQuery * query_copy (GlyrQuery * src);
+
+/* Queue a background job writing the results of query to it's local_db */
+GLYR_ERROR prefetch_schedule (GlyrQuery * query);
+
+/* Called by glyr_get() around a search, waits for prefetches of the same key.
+ * prefetched is set if such a prefetch finished meanwhile, its results are in the db then.
+ */
+gpointer prefetch_enter (GlyrQuery * query, gboolean * prefetched);
+void prefetch_leave (gpointer inflight);
+
+/* Wait till no prefetch job uses db anymore */
+void prefetch_drain (GlyrDatabase * db);
+
+/* Stop all jobs, called by glyr_cleanup() */
+void prefetch_shutdown (void);
+
+#endif
@@ -27,6 +27,7 @@
 #include "stringlib.h"
 #include "core.h"
 #include "types.h"
+#include "hash.h"
 
 /* Implementation of the Levenshtein distance algorithm
  * Compare the number of edits needed to convert string $s
@@ -266,6 +267,7 @@ gsize levenshtein_strnormcmp (GlyrQuery * settings, const gchar * string, const
 
         g_free (normalized_string);
         g_free (normalized_other);
+        record_match_distance (diff);
     }
     return diff;
 }
@@ -330,6 +332,57 @@ gchar * unwind_artist_name (const gchar * artist)
 
 ///////////////////////////////////////
 
+/* Same normalization as levenshtein_strnormcmp(),
+ * then only lowercase letters and digits are kept, without a leading "the"
+ */
+gchar * normalize_lookup_key (const gchar * name)
+{
+    if (name == NULL)
+    {
+        return NULL;
+    }
+
+    GString * key = g_string_sized_new (strlen (name) );
+    gchar * normalized = leven_normalize_string (name);
+    gchar * composed = (normalized) ? g_utf8_normalize (normalized,-1,G_NORMALIZE_ALL_COMPOSE) : NULL;
+    gchar * lower = (composed) ? g_utf8_strdown (composed,-1) : NULL;
+
+    if (lower != NULL)
+    {
+        const gchar * start = g_strchug (lower);
+        if (g_str_has_prefix (start,"the ") )
+        {
+            start += 4;
+        }
+
+        for (const gchar * iter = start; *iter; iter = g_utf8_next_char (iter) )
+        {
+            gunichar c = g_utf8_get_char (iter);
+            if (g_unichar_isalnum (c) )
+            {
+                g_string_append_unichar (key,c);
+            }
+        }
+    }
+
+    /* Nothing left of it (or no valid UTF-8) - take it as it is */
+    if (key->len == 0)
+    {
+        g_string_assign (key,name);
+        for (gsize i = 0; i < key->len; i++)
+        {
+            key->str[i] = g_ascii_tolower (key->str[i]);
+        }
+    }
+
+    g_free (lower);
+    g_free (composed);
+    g_free (normalized);
+    return g_string_free (key,FALSE);
+}
+
+///////////////////////////////////////
+
 gchar * prepare_string (const gchar * input, GLYR_NORMALIZATION mode, gboolean do_curl_escape)
 {
     gchar * result = NULL;
@@ -542,6 +595,77 @@ char *unescape_html_UTF8 (const char * data)
 
 ///////////////////////////////////////
 
+/* Parses the number of a &#123; or &#x7B; entity, between begin and end (the ';') */
+static gunichar parse_entity_number (const gchar * begin, const gchar * end)
+{
+    guint base = 10;
+    if (begin < end && (*begin == 'x' || *begin == 'X') )
+    {
+        base = 16;
+        begin++;
+    }
+
+    gunichar n = 0;
+    for (; begin < end; begin++)
+    {
+        gint digit = (base == 16) ? g_ascii_xdigit_value (*begin) : g_ascii_digit_value (*begin);
+        if (digit < 0 || n > 0x10FFFF)
+        {
+            return 0;
+        }
+        n = n * base + digit;
+    }
+    return n;
+}
+
+/* An entity is at least 4 bytes (&#9;), and its UTF-8 sequence never longer,
+ * so the output never overtakes the input.
+ */
+gsize unescape_html_UTF8_inplace (gchar * data, gsize len)
+{
+    gsize iB = 0;
+    if (data != NULL)
+    {
+        gboolean tagflag = FALSE;
+        gsize tag_open = 0;
+
+        for (gsize i = 0; i < len; ++i)
+        {
+            const gchar * semicol = NULL;
+            if (data[i] == '&' && i + 1 < len && data[i+1] == '#' && (semicol = memchr (data + i,';',len - i) ) != NULL)
+            {
+                gunichar n = parse_entity_number (data + i + 2,semicol);
+                if (n != 0 && g_unichar_validate (n) )
+                {
+                    iB += g_unichar_to_utf8 (n,data + iB);
+                }
+                i = semicol - data;
+            }
+            else if (data[i] == '<')
+            {
+                tag_open = i + 1;
+                tagflag = TRUE;
+            }
+            else if (tagflag == FALSE)
+            {
+                data[iB++] = data[i];
+            }
+            else if (data[i] == '>')
+            {
+                if (g_strstr_len (data + tag_open,MIN (7,len - tag_open),"br") != NULL)
+                {
+                    data[iB++] = '\n';
+                }
+                tagflag = FALSE;
+            }
+        }
+        data[iB] = 0;
+    }
+    return iB;
+}
+
+///////////////////////////////////////
+
 /* List from http://stackoverflow.com/questions/1082162/how-to-unescape-html-in-c/1082191#1082191,
  * Thanks for this. Probably directly from wikipedia: https://secure.wikimedia.org/wikipedia/en/wiki/List_of_XML_and_HTML_character_entity_references
  * I don't know a way how this can be done easier. But it's working well, so I guess I just let it be...
@@ -1134,6 +1258,75 @@ gchar * convert_charset (const gchar * string, gchar * from, gchar * to, gsize *
 
 ///////////////////////////////////////
 
+/* Opening a converter is much more expensive than converting a few kB.
+ * A converter has a state, so every (parse-) thread keeps its own ones.
+ */
+static void close_converter (gpointer converter)
+{
+    g_iconv_close ( (GIConv) converter);
+}
+
+static void destroy_convert_cache (gpointer cache)
+{
+    g_hash_table_destroy ( (GHashTable *) cache);
+}
+
+static GPrivate convert_cache = G_PRIVATE_INIT (destroy_convert_cache);
+
+gchar * convert_to_utf8_cached (const gchar * string, gsize len, const gchar * encoding, gsize * new_size)
+{
+    gchar * conv_string = NULL;
+    if (string == NULL || encoding == NULL)
+    {
+        return NULL;
+    }
+
+    GHashTable * cache = g_private_get (&convert_cache);
+    if (cache == NULL)
+    {
+        cache = g_hash_table_new_full (g_str_hash,g_str_equal,g_free,close_converter);
+        g_private_set (&convert_cache,cache);
+    }
+
+    GIConv converter = g_hash_table_lookup (cache,encoding);
+    if (converter == NULL)
+    {
+        converter = g_iconv_open ("UTF-8",encoding);
+        if (converter != (GIConv) -1)
+        {
+            g_hash_table_insert (cache,g_strdup (encoding),converter);
+        }
+        else
+        {
+            converter = NULL;
+            g_print ("Unable to convert charsets.\n");
+        }
+    }
+
+    if (converter != NULL)
+    {
+        /* Reset shift state left over from the last call */
+        g_iconv (converter,NULL,NULL,NULL,NULL);
+
+        GError * error = NULL;
+        conv_string = g_convert_with_iconv (string,len,converter,NULL,new_size,&error);
+        if (conv_string == NULL)
+        {
+            g_print ("conversion-error: %s\n",error ? error->message : "unknown");
+            g_clear_error (&error);
+        }
+    }
+    return conv_string;
+}
+
+void convert_cache_cleanup (void)
+{
+    /* The ones of other threads go with them */
+    g_private_replace (&convert_cache,NULL);
+}
+
+///////////////////////////////////////
+
 gchar * get_search_value (gchar * ref, gchar * name, gchar * end_string)
 {
     gchar * result = NULL;
@@ -1188,6 +1381,244 @@ gboolean regex_match_compiled (const gchar * string, const GRegex * cRegex)
     return retv;
 }
 
+/////////////////////////////////
+
+/* Lowercase words of text, without punctuation and markup */
+static GPtrArray * split_words (const gchar * text, gsize size)
+{
+    GPtrArray * words = g_ptr_array_new();
+    GString * word = g_string_new (NULL);
+    gboolean in_tag = FALSE;
+
+    const gchar * end = text + size;
+    for (const gchar * p = text; p < end && *p; p = g_utf8_next_char (p) )
+    {
+        gunichar c = g_utf8_get_char_validated (p,end - p);
+        if (c == (gunichar) -1 || c == (gunichar) -2)
+        {
+            break;
+        }
+
+        /* HTML leftovers are no words */
+        if (c == '<')
+        {
+            in_tag = TRUE;
+        }
+
+        if (in_tag == TRUE)
+        {
+            in_tag = (c != '>');
+        }
+        else if (g_unichar_isalnum (c) )
+        {
+            g_string_append_unichar (word,g_unichar_tolower (c) );
+            continue;
+        }
+
+        if (word->len != 0)
+        {
+            g_ptr_array_add (words,g_strndup (word->str,word->len) );
+            g_string_truncate (word,0);
+        }
+    }
+
+    if (word->len != 0)
+    {
+        g_ptr_array_add (words,g_strndup (word->str,word->len) );
+    }
+
+    g_string_free (word,TRUE);
+    return words;
+}
+
+/////////////////////////////////
+
+/* MinHash over the word 3-grams of text.
+ * The i-th value is the minimum of lo + i * hi over all 3-grams,
+ * lo and hi being the two halves of the 3-gram's hash.
+ */
+gboolean minhash_text (const gchar * text, gsize size, guint32 * signature)
+{
+    GPtrArray * words = split_words ( (text) ? text : "", (text) ? size : 0);
+    guint n_words = MINHASH_SHINGLE_WORDS;
+    guint n_shingles = (words->len >= n_words) ? words->len - n_words + 1 : 0;
+
+    for (gint i = 0; i < MINHASH_SIZE; i++)
+    {
+        signature[i] = 0xFFFFFFFF;
+    }
+
+    GString * shingle = g_string_new (NULL);
+    for (guint s = 0; s < n_shingles; s++)
+    {
+        g_string_truncate (shingle,0);
+        for (guint w = 0; w < n_words; w++)
+        {
+            g_string_append (shingle,g_ptr_array_index (words,s + w) );
+            g_string_append_c (shingle,' ');
+        }
+
+        guchar digest[CONTENT_HASH_SIZE];
+        content_hash (shingle->str,shingle->len,digest);
+
+        guint32 lo, hi;
+        memcpy (&lo,digest + 0,sizeof (lo) );
+        memcpy (&hi,digest + 4,sizeof (hi) );
+        for (guint32 i = 0; i < MINHASH_SIZE; i++)
+        {
+            signature[i] = MIN (signature[i],lo + i * hi);
+        }
+    }
+    g_string_free (shingle,TRUE);
+
+    for (guint i = 0; i < words->len; i++)
+    {
+        g_free (g_ptr_array_index (words,i) );
+    }
+    g_ptr_array_free (words,TRUE);
+    return (n_shingles > 0);
+}
+
+/////////////////////////////////
+
+gdouble minhash_similarity (const guint32 * a, const guint32 * b)
+{
+    gint equal = 0;
+    for (gint i = 0; i < MINHASH_SIZE; i++)
+    {
+        equal += (a[i] == b[i]);
+    }
+    return equal / (gdouble) MINHASH_SIZE;
+}
+
+/////////////////////////////////
+
+/* Reads a number in url at pos, if it looks like an image dimension */
+static gint read_dimension (const gchar * pos, const gchar ** end)
+{
+    gint64 value = g_ascii_strtoll (pos, (gchar **) end,10);
+    return (value >= 16 && value <= 10000) ? (gint) value : 0;
+}
+
+/////////////////////////////////
+
+/* Finds the size hints in url and returns the largest one, 0 if there's none.
+ * If stripped is given, it is set to url with every hint replaced by a '#'.
+ */
+static gint scan_image_size (const gchar * url, GString * stripped)
+{
+    /* Names of the sizes used by last.fm and others; more specific ones first */
+    static const struct
+    {
+        const gchar * word;
+        gint size;
+    } size_words[] =
+    {
+        {"original",   1000},
+        {"mega",        600},
+        {"extralarge",  300},
+        {"large",       174},
+        {"medium",       64},
+        {"thumb",        64},
+        {"small",        34}
+    };
+
+    gint size = 0;
+    const gchar * pos = url;
+    while (*pos)
+    {
+        const gchar * end = pos;
+        gint value = 0;
+        gboolean is_hint = FALSE;
+
+        if (g_ascii_isdigit (*pos) && (pos == url || g_ascii_isdigit (pos[-1]) == FALSE) && (value = read_dimension (pos,&end) ) != 0)
+        {
+            if (*end == 'x' && g_ascii_isdigit (end[1]) )
+            {
+                /* 500x500 */
+                value = MAX (value,read_dimension (end + 1,&end) );
+                is_hint = TRUE;
+            }
+            else if (pos - url >= 3 && pos[-3] == '_' && g_ascii_isupper (pos[-2]) && g_ascii_isupper (pos[-1]) && *end == '_')
+            {
+                /* amazon: ._SL500_ or ._AA300_ */
+                is_hint = TRUE;
+            }
+            else if (pos > url && pos[-1] == '/' && end[0] == 's' && end[1] == '/')
+            {
+                /* last.fm: /174s/ */
+                is_hint = TRUE;
+            }
+        }
+
+        if (is_hint == TRUE)
+        {
+            size = MAX (size,value);
+            if (stripped != NULL)
+            {
+                g_string_append_c (stripped,'#');
+            }
+            pos = end;
+        }
+        else
+        {
+            if (stripped != NULL)
+            {
+                g_string_append_c (stripped,*pos);
+            }
+            pos++;
+        }
+    }
+
+    if (size == 0)
+    {
+        gchar * lower = g_ascii_strdown (url,-1);
+        for (gsize i = 0; i < G_N_ELEMENTS (size_words) && size == 0; i++)
+        {
+            const gchar * found = strstr (lower,size_words[i].word);
+            if (found != NULL)
+            {
+                size = size_words[i].size;
+                if (stripped != NULL)
+                {
+                    g_string_assign (stripped,lower);
+                    g_string_erase (stripped,found - lower,strlen (size_words[i].word) );
+                    g_string_insert_c (stripped,found - lower,'#');
+                }
+            }
+        }
+        g_free (lower);
+    }
+    return size;
+}
+
+/////////////////////////////////
+
+gint guess_image_size (const gchar * url)
+{
+    return (url != NULL) ? scan_image_size (url,NULL) : 0;
+}
+
+/////////////////////////////////
+
+gchar * strip_image_size (const gchar * url)
+{
+    gchar * result = NULL;
+    if (url != NULL)
+    {
+        GString * stripped = g_string_new (NULL);
+        if (scan_image_size (url,stripped) > 0)
+        {
+            result = g_string_free (stripped,FALSE);
+        }
+        else
+        {
+            g_string_free (stripped,TRUE);
+        }
+    }
+    return result;
+}
+
 #if 0
 int main (int argc, char * argv[])
 {
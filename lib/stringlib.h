@@ -47,6 +47,12 @@ gchar * strreplace (const gchar * string, const gchar * subs, const gchar * with
 /* Converts charset of 'string' from charset 'from' to charset 'to', number of bytes saved in new_size (can be NULL) */
 gchar * convert_charset (const gchar * string, gchar * from, gchar * to, gsize * new_size);
 
+/* Converts len bytes of 'string' from 'encoding' to UTF-8, reusing the iconv descriptor of earlier calls */
+gchar * convert_to_utf8_cached (const gchar * string, gsize len, const gchar * encoding, gsize * new_size);
+
+/* Closes the descriptors of convert_to_utf8_cached() opened by the calling thread */
+void convert_cache_cleanup (void);
+
 /* Replaces HTML-unicode strings like &ouml; with their UTF-8 bytes */
 gchar * strip_html_unicode (const gchar * string);
 
@@ -74,6 +80,9 @@ gsize remove_tags_from_string (gchar * string, gint length, gchar start, gchar e
 /* Unescapes HTML numeric unicode entities to normal UTF8 strings */
 gchar * unescape_html_UTF8 (const gchar *data);
 
+/* Same as above, but inplace on len bytes of data. Returns the new length */
+gsize unescape_html_UTF8_inplace (gchar * data, gsize len);
+
 /* Puts artist, album title in the string URL where it is ${artist},${album},${title} */
 gchar * prepare_url (const gchar * URL, GlyrQuery * s, gboolean do_curl_escape);
 
@@ -97,4 +106,27 @@ gboolean regex_match_compiled (const gchar * string, const GRegex * cRegex);
 
 gchar * unwind_artist_name (const gchar * artist);
 
+/* Key to look names up in the cache: "Beatles, The", "the beatles" and "The Beatles (Remastered)" all give "beatles" */
+gchar * normalize_lookup_key (const gchar * name);
+
+/* Number of values in a MinHash signature */
+#define MINHASH_SIZE 64
+
+/* Words per shingle; shorter texts have no signature */
+#define MINHASH_SHINGLE_WORDS 3
+
+/* Builds a MinHash signature of the word 3-grams of text, ignoring case, punctuation and HTML tags.
+ * Returns FALSE if text has less than MINHASH_SHINGLE_WORDS words, signature is useless then.
+ */
+gboolean minhash_text (const gchar * text, gsize size, guint32 * signature);
+
+/* Estimated jaccard similarity of two signatures, [0.0 - 1.0] */
+gdouble minhash_similarity (const guint32 * a, const guint32 * b);
+
+/* Guess the edge length of an image in pixels from hints in its URL (500x500, _SL500_, extralarge..), 0 if unknown */
+gint guess_image_size (const gchar * url);
+
+/* url with its size hints replaced, so all sizes of one image give the same string; NULL if url has none */
+gchar * strip_image_size (const gchar * url);
+
 #endif
@@ -23,6 +23,7 @@
 #include "core.h"
 #include "stringlib.h"
 #include "register_plugins.h"
+#include "cache_intern.h"
 
 /////////////////////////////////
 
@@ -114,3 +115,28 @@ GlyrMemCache * glyr_testing_call_parser (const char * provider_name, GLYR_GET_TY
 }
 
 /////////////////////////////////
+
+__attribute__ ( (visibility ("default") ) )
+void glyr_testing_remember_miss (GlyrDatabase * db, GlyrQuery * query, const char * provider_name)
+{
+    if (db && query && provider_name)
+    {
+        db_miss_update (db,query,provider_name,FALSE);
+    }
+}
+
+/////////////////////////////////
+
+__attribute__ ( (visibility ("default") ) )
+double glyr_testing_text_similarity (const char * a, const char * b)
+{
+    guint32 sig_a[MINHASH_SIZE], sig_b[MINHASH_SIZE];
+    if (minhash_text (a, (a) ? strlen (a) : 0,sig_a) == FALSE ||
+        minhash_text (b, (b) ? strlen (b) : 0,sig_b) == FALSE)
+    {
+        return -1.0;
+    }
+    return minhash_similarity (sig_a,sig_b);
+}
+
+/////////////////////////////////
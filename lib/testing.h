@@ -67,6 +67,29 @@ extern "C"
      **/
     GlyrMemCache * glyr_testing_call_parser (const char * provider_name, GLYR_GET_TYPE type, GlyrQuery * query, GlyrMemCache * cache);
 
+    /**
+     * glyr_testing_remember_miss:
+     * @db: The database to write to
+     * @query: What was searched for
+     * @provider_name: The provider that had nothing
+     *
+     * Remember a miss, as if @provider_name answered @query without any item (see glyr_db_set_miss_ttl()).
+     * This is meant for testing purpose only.
+     **/
+    void glyr_testing_remember_miss (GlyrDatabase * db, GlyrQuery * query, const char * provider_name);
+
+    /**
+     * glyr_testing_text_similarity:
+     * @a: A text, may contain HTML
+     * @b: Another one
+     *
+     * Estimate how similar two texts are, as done to drop copies of lyrics, bios etc. delivered by more than one provider.
+     * This is meant for testing purpose only.
+     *
+     * Returns: 0.0 (different) - 1.0 (the same), or -1.0 if one of them is too short to compare.
+     **/
+    double glyr_testing_text_similarity (const char * a, const char * b);
+
 
 #ifdef __cplusplus
 }
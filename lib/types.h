@@ -66,6 +66,10 @@ extern "C"
 #define GLYR_DEFAULT_SUPPORTED_LANGS "en;de;fr;es;it;jp;pl;pt;ru;sv;tr;zh"
 #define GLYR_DEFAULT_LANG_AWARE_ONLY false
 #define GLYR_DEFAULT_NORMALIZATION GLYR_NORMALIZE_MODERATE
+#define GLYR_DEFAULT_PRIORITY GLYR_PRIORITY_INTERACTIVE
+#define GLYR_DEFAULT_AUTOTUNE false
+#define GLYR_DEFAULT_IMG_DEDUP false
+#define GLYR_DEFAULT_CONFIDENCE 0.0
 
     /* Disallow *.gif, mostly bad quality
      * jpeg and jpg, because some not standardaware
@@ -107,6 +111,22 @@ extern "C"
     }
                                  GLYR_NORMALIZATION;
 
+    /**
+     * GLYR_PRIORITY:
+     * @GLYR_PRIORITY_INTERACTIVE: Somebody waits for the result, serve this query first.
+     * @GLYR_PRIORITY_BACKGROUND: Bulk work like library scans; only runs on free slots.
+     *
+     * The priority class of a query, set via glyr_opt_priority().
+     *
+     * Default is: GLYR_PRIORITY_INTERACTIVE
+     **/
+    typedef enum
+    {
+        GLYR_PRIORITY_INTERACTIVE,
+        GLYR_PRIORITY_BACKGROUND
+    }
+    GLYR_PRIORITY;
+
     /**
      * GLYR_ERROR:
      * @GLYRE_UNKNOWN: Unknown error
@@ -293,6 +313,7 @@ extern "C"
      * @md5sum: A md5sum of the data field.
      * @cached: If this cache was locally cached.
      * @timestamp: This is used internally by libglyr.
+     * @score: Confidence in this item from 0.0 to 1.0, results are sorted by it (best first).
      * @next: A pointer to the next item in the list, or NULL
      * @prev: A pointer to the previous item in the list, or NULL
      *
@@ -317,6 +338,7 @@ extern "C"
         unsigned char md5sum[16];
         bool cached;
         double timestamp;
+        float score;
 
         struct _GlyrMemCache * next;
         struct _GlyrMemCache * prev;
@@ -337,6 +359,10 @@ extern "C"
 
         /*< private >*/
         sqlite3 * db_handle;
+        struct _GlyrDBStatements * statements;
+        struct _BloomFilter * known_items;
+        struct _GlyrDBReaders * readers;
+        struct _GlyrDBPolicy * policy;
 
     } GlyrDatabase;
 
@@ -371,6 +397,10 @@ extern "C"
     * @musictree_path: Used for the musictree provider.
     * @q_errno: Any error that happenend during glyr_get() (same as argument to glyr_get())
     * @normalization: What normalization to apply to artist/album/title; GLYR_NORMALIZE_MODERATE is default.
+    * @priority: The #GLYR_PRIORITY of this query; GLYR_PRIORITY_INTERACTIVE is default.
+    * @autotune: Learn parallel and the transfer timeouts from previous queries.
+    * @img_dedup: Drop images looking like already found ones, keep the largest.
+    * @confidence: Stop searching once an item has at least this score, 0.0 disables this.
     *
     * This structure holds all settings used to influence libglyr.
     * You should set all fields glyr_opt_*, refer also to the documentation there to find out their exact meaning.
@@ -408,6 +438,11 @@ extern "C"
 
         bool lang_aware_only;
 
+        GLYR_PRIORITY priority;
+        bool autotune;
+        bool img_dedup;
+        float confidence;
+
         /* Signal conditions */
         volatile int signal_exit;
 
@@ -435,6 +470,7 @@ extern "C"
         char * info[10]; /*!< Do not use! - A register where porinters to all dynamic alloc. fields are saved. Do not use. */
         bool imagejob; /*! Do not use! - Wether this query will get images or urls to them */
         long is_initalized; /* Do not use! - Wether this query was initialized correctly */
+        void * run_state; /* Do not use! - Bookkeeping of the search currently running with this query */
 
     } GlyrQuery;
 
@@ -514,6 +550,22 @@ extern "C"
     */
     typedef GLYR_ERROR (*DL_callback) (GlyrMemCache * dl, struct _GlyrQuery * s);
 
+    /**
+     * GlyrPlan:
+     *
+     * An opaque set of queries that depend on the results of each other,
+     * see glyr_plan_new(). It's members should not be accessed directly.
+     */
+    typedef struct _GlyrPlan GlyrPlan;
+
+    /**
+     * GlyrPlanStage:
+     *
+     * One opaque stage of a #GlyrPlan, see glyr_plan_add_stage().
+     * It is freed together with the plan.
+     */
+    typedef struct _GlyrPlanStage GlyrPlanStage;
+
 #ifdef __cplusplus
 }
 #endif
@@ -19,6 +19,7 @@
  **************************************************************/
 
 #include "test_common.h"
+#include "../../lib/testing.h"
 #include <check.h>
 #include <glib.h>
 
@@ -197,6 +198,91 @@ END_TEST
 
 //--------------------
 
+static GLYR_ERROR count_plan_items (GlyrMemCache * c, GlyrQuery * q)
+{
+    gint * counter = q->callback.user_pointer;
+    g_atomic_int_inc (&counter[c->type]);
+    return GLYRE_OK;
+}
+
+START_TEST (test_glyr_plan)
+{
+    glyr_init();
+    atexit (glyr_cleanup);
+
+    gint counter[GLYR_TYPE_BACKDROPS + 1] = {0};
+
+    GlyrQuery q;
+    glyr_query_init (&q);
+    glyr_opt_artist (&q,"Equilibrium");
+    glyr_opt_type (&q,GLYR_GET_ALBUMLIST);
+    glyr_opt_number (&q,2);
+    glyr_opt_dlcallback (&q,count_plan_items,counter);
+
+    fail_unless (glyr_plan_new (NULL) == NULL,NULL);
+    GlyrPlan * plan = glyr_plan_new (&q);
+    fail_unless (plan != NULL,NULL);
+    fail_unless (glyr_plan_add_stage (plan,NULL,GLYR_GET_TRACKLIST,0) == NULL,NULL);
+
+    GlyrPlanStage * tracks = glyr_plan_add_stage (plan,glyr_plan_root (plan),GLYR_GET_TRACKLIST,0);
+    fail_unless (tracks != NULL,NULL);
+    fail_unless (glyr_plan_execute (plan) == GLYRE_OK,NULL);
+
+    fail_unless (counter[GLYR_TYPE_ALBUMLIST] == 2,"Root stage should deliver 2 albums");
+    fail_unless (counter[GLYR_TYPE_TRACK] > 0,"Tracklists of the albums should be found");
+
+    glyr_plan_destroy (plan);
+    glyr_query_destroy (&q);
+}
+END_TEST
+
+//--------------------
+
+START_TEST (test_glyr_cache_materialize)
+{
+    GlyrQuery q;
+    setup (&q,GLYR_GET_COVERART,2);
+    glyr_opt_download (&q,false);
+
+    int length = 0;
+    GlyrMemCache * list = glyr_get (&q,NULL,&length);
+    fail_unless (length == 2,"Should find two cover URLs");
+    fail_unless (glyr_cache_materialize (NULL,0,&q) == 0,NULL);
+
+    fail_unless (glyr_cache_materialize (list,1,&q) == 1,"First cover should be downloaded");
+    fail_unless (list->is_image == true,NULL);
+    fail_unless (list->type == GLYR_TYPE_COVERART,NULL);
+    fail_unless (list->next->type == GLYR_TYPE_IMG_URL,"Second cover should still be an URL");
+
+    /* Already downloaded ones are not touched again */
+    fail_unless (glyr_cache_materialize (list,0,&q) <= 1,NULL);
+
+    unsetup (&q,list);
+}
+END_TEST
+
+//--------------------
+
+START_TEST (test_glyr_text_similarity)
+{
+    const char * text = "I walk a lonely road, the only one that I have ever known";
+    const char * copy = "<p>I walk a <b>lonely</b> road,</p>\n\nthe ONLY one that I have ever known!";
+    const char * other = "Wake me up when september ends, like my father's come to pass";
+
+    fail_unless (glyr_testing_text_similarity (text,copy) >= 0.8,"Markup and case should not matter");
+    fail_unless (glyr_testing_text_similarity (text,other) < 0.8,"Different texts are not the same");
+
+    /* No signature, so never dropped as copies of each other */
+    fail_unless (glyr_testing_text_similarity ("","") < 0.0,NULL);
+    fail_unless (glyr_testing_text_similarity (NULL,text) < 0.0,NULL);
+    fail_unless (glyr_testing_text_similarity ("<br/> ... <br/>","!!!") < 0.0,"Texts without words have no signature");
+    fail_unless (glyr_testing_text_similarity ("Instrumental","Instrumental") < 0.0,"Too short to shingle");
+    fail_unless (glyr_testing_text_similarity ("la la la",text) >= 0.0,"Three words are enough");
+}
+END_TEST
+
+//--------------------
+
 Suite * create_test_suite (void)
 {
     Suite *s = suite_create ("Libglyr API");
@@ -213,6 +299,9 @@ Suite * create_test_suite (void)
     tcase_add_test (tc_core, test_glyr_cache_set_data);
     tcase_add_test (tc_core, test_glyr_cache_write);
     tcase_add_test (tc_core, test_glyr_download);
+    tcase_add_test (tc_core, test_glyr_plan);
+    tcase_add_test (tc_core, test_glyr_cache_materialize);
+    tcase_add_test (tc_core, test_glyr_text_similarity);
     suite_add_tcase (s, tc_core);
     return s;
 }
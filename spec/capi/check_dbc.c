@@ -21,9 +21,11 @@
 #include "test_common.h"
 
 #include "../../lib/cache.h"
+#include "../../lib/testing.h"
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
 //--------------------
@@ -307,6 +309,45 @@ END_TEST
 
 //--------------------
 
+START_TEST (test_normalized_lookup)
+{
+    GlyrDatabase * db = setup_db();
+
+    GlyrQuery q;
+    setup (&q,GLYR_GET_COVERART,1);
+    glyr_opt_artist (&q,"The Beatles");
+    glyr_opt_album (&q,"Abbey Road (Remastered)");
+
+    GlyrMemCache * cover = glyr_cache_new();
+    glyr_cache_set_data (cover,g_strdup ("http://images.com/abbey.jpg"),-1);
+    cover->type = GLYR_TYPE_COVERART;
+    glyr_db_insert (db,&q,cover);
+
+    /* Spelling variants of the same names */
+    glyr_opt_artist (&q,"Beatles, The");
+    glyr_opt_album (&q,"abbey road");
+    GlyrMemCache * found = glyr_db_lookup (db,&q);
+    fail_unless (found != NULL, NULL);
+    fail_unless (memcmp (found->md5sum,cover->md5sum,16) == 0, NULL);
+    glyr_free_list (found);
+
+    /* A typo is only found by the fuzzy fallback, which is off by default */
+    glyr_opt_artist (&q,"The Beatls");
+    fail_unless (glyr_db_lookup (db,&q) == NULL, NULL);
+
+    glyr_db_set_fuzzy_lookup (db,2);
+    found = glyr_db_lookup (db,&q);
+    fail_unless (found != NULL, NULL);
+    glyr_free_list (found);
+
+    glyr_cache_free (cover);
+    glyr_query_destroy (&q);
+    glyr_db_destroy (db);
+}
+END_TEST
+
+//--------------------
+
 START_TEST (test_db_editplace)
 {
 
@@ -349,6 +390,355 @@ START_TEST (test_db_editplace)
 }
 END_TEST
 
+//--------------------
+
+static GlyrMemCache * make_batch (const char * name, int n)
+{
+    GlyrMemCache * list = NULL, * last = NULL;
+    for (int i = 0; i < n; i++)
+    {
+        GlyrMemCache * ct = glyr_cache_new();
+        glyr_cache_set_data (ct,g_strdup_printf ("%s %d",name,i),-1);
+        ct->dsrc = g_strdup_printf ("http://batch.com/%s/%d",name,i);
+        ct->prev = last;
+        if (last != NULL)
+            last->next = ct;
+        else
+            list = ct;
+        last = ct;
+    }
+    return list;
+}
+
+START_TEST (test_insert_batch)
+{
+    const int N = 100;
+
+    GlyrDatabase * db = setup_db();
+
+    GlyrQuery q;
+    setup (&q,GLYR_GET_LYRICS,N);
+
+    GlyrMemCache * list = make_batch ("first",N);
+    fail_unless (glyr_db_insert_batch (NULL,&q,list) == 0, NULL);
+    fail_unless (glyr_db_insert_batch (db,&q,NULL) == 0, NULL);
+    fail_unless (glyr_db_insert_batch (db,&q,list) == N, NULL);
+    fail_unless (count_db_items (db) == N, NULL);
+
+    /* Already there */
+    fail_unless (glyr_db_insert_batch (db,&q,list) == 0, NULL);
+
+    /* Nested batches of several queries */
+    GlyrQuery other;
+    setup (&other,GLYR_GET_LYRICS,N);
+    glyr_opt_artist (&other,"Another artist");
+
+    GlyrMemCache * second = make_batch ("second",N);
+    GlyrMemCache * dummy = glyr_db_make_dummy();
+
+    glyr_db_batch_begin (db);
+    glyr_db_batch_begin (db);
+    glyr_db_insert_batch (db,&other,second);
+    glyr_db_batch_end (db);
+    glyr_db_insert (db,&other,dummy);
+    glyr_db_batch_end (db);
+    fail_unless (count_db_items (db) == 2 * N + 1, NULL);
+
+    glyr_free_list (list);
+    glyr_free_list (second);
+    glyr_cache_free (dummy);
+    glyr_query_destroy (&q);
+    glyr_query_destroy (&other);
+    glyr_db_destroy (db);
+}
+END_TEST
+
+//--------------------
+
+START_TEST (test_delete_many)
+{
+    const int N = 100;
+
+    GlyrDatabase * db = setup_db();
+
+    GlyrQuery q;
+    setup (&q,GLYR_GET_LYRICS,N);
+
+    GlyrMemCache * list = make_batch ("delete",N);
+    glyr_db_insert_batch (db,&q,list);
+
+    /* query->number limits the deleted items */
+    glyr_opt_number (&q,30);
+    fail_unless (glyr_db_delete (db,&q) == 30, NULL);
+    fail_unless (count_db_items (db) == N - 30, NULL);
+
+    glyr_opt_number (&q,0);
+    fail_unless (glyr_db_delete (db,&q) == N - 30, NULL);
+    fail_unless (count_db_items (db) == 0, NULL);
+
+    glyr_free_list (list);
+    glyr_query_destroy (&q);
+    glyr_db_destroy (db);
+}
+END_TEST
+
+//--------------------
+
+START_TEST (test_maintain)
+{
+    const int N = 100;
+
+    GlyrDatabase * db = setup_db();
+
+    GlyrQuery q;
+    setup (&q,GLYR_GET_LYRICS,N);
+
+    GlyrMemCache * list = make_batch ("maintain",N);
+    glyr_db_insert_batch (db,&q,list);
+
+    /* Nothing to do without limits */
+    fail_unless (glyr_db_maintain (db,0) == 0, NULL);
+    fail_unless (count_db_items (db) == N, NULL);
+
+    /* Forgetting misses leaves the items alone */
+    glyr_db_set_miss_ttl (db,0);
+    fail_unless (glyr_db_maintain (db,0) == 0, NULL);
+    fail_unless (count_db_items (db) == N, NULL);
+
+    /* Expire by type */
+    glyr_db_set_ttl (db,GLYR_GET_COVERART,0.001);
+    g_usleep (10 * 1000);
+    fail_unless (glyr_db_maintain (db,0) == 0, NULL);
+
+    glyr_db_set_ttl (db,GLYR_GET_LYRICS,0.001);
+    fail_unless (glyr_db_maintain (db,0) == N, NULL);
+    fail_unless (count_db_items (db) == 0, NULL);
+
+    /* Evicted till it fits, which never happens for one byte */
+    glyr_db_set_ttl (db,GLYR_GET_LYRICS,0);
+    glyr_db_insert_batch (db,&q,list);
+    GlyrMemCache * found = glyr_db_lookup (db,&q);
+    fail_unless (found != NULL, NULL);
+
+    glyr_db_set_max_size (db,1);
+    fail_unless (glyr_db_maintain (db,0) == N, NULL);
+    fail_unless (count_db_items (db) == 0, NULL);
+
+    glyr_free_list (found);
+    glyr_free_list (list);
+    glyr_query_destroy (&q);
+    glyr_db_destroy (db);
+}
+END_TEST
+
+//--------------------
+
+static gpointer lookup_thread (gpointer db)
+{
+    GlyrQuery q;
+    setup (&q,GLYR_GET_LYRICS,10);
+
+    gint found = 0;
+    for (int i = 0; i < 100; i++)
+    {
+        GlyrMemCache * list = glyr_db_lookup (db,&q);
+        found += (list != NULL);
+        glyr_free_list (list);
+    }
+
+    glyr_query_destroy (&q);
+    return GINT_TO_POINTER (found);
+}
+
+START_TEST (test_parallel_lookup)
+{
+    GlyrDatabase * db = setup_db();
+
+    GlyrQuery q;
+    setup (&q,GLYR_GET_LYRICS,10);
+    GlyrMemCache * list = make_batch ("parallel",10);
+    glyr_db_insert_batch (db,&q,list);
+
+    GThread * threads[8];
+    for (int i = 0; i < 8; i++)
+    {
+        threads[i] = g_thread_new ("lookup",lookup_thread,db);
+    }
+
+    /* Writing goes on while the others read */
+    GlyrMemCache * dummy = glyr_db_make_dummy();
+    glyr_db_insert (db,&q,dummy);
+
+    for (int i = 0; i < 8; i++)
+    {
+        fail_unless (GPOINTER_TO_INT (g_thread_join (threads[i]) ) == 100, NULL);
+    }
+
+    glyr_free_list (list);
+    glyr_cache_free (dummy);
+    glyr_query_destroy (&q);
+    glyr_db_destroy (db);
+}
+END_TEST
+
+//--------------------
+
+START_TEST (test_blob_store)
+{
+    GlyrDatabase * db = setup_db();
+
+    GlyrQuery one, two;
+    setup (&one,GLYR_GET_COVERART,1);
+    setup (&two,GLYR_GET_COVERART,1);
+    glyr_opt_album (&two,"Rekreatur");
+    glyr_opt_download (&one,true);
+    glyr_opt_download (&two,true);
+
+    /* Large enough to leave the db */
+    const gsize size = 64 * 1024;
+    GlyrMemCache * image = glyr_cache_new();
+    gchar * data = g_malloc (size);
+    for (gsize i = 0; i < size; i++)
+        data[i] = i % 251;
+
+    glyr_cache_set_data (image,data,size);
+    glyr_cache_set_img_format (image,"jpeg");
+    image->is_image = true;
+    image->type = GLYR_TYPE_COVERART;
+    image->dsrc = g_strdup ("http://images.com/sagas.jpg");
+
+    glyr_db_insert (db,&one,image);
+    glyr_db_insert (db,&two,image);
+
+    /* Stored once, named after the md5sum */
+    gchar * key = g_compute_checksum_for_data (G_CHECKSUM_MD5, (guchar *) image->data,image->size);
+    gchar * path = g_strdup_printf ("/tmp/check/blobs/%.2s/%s",key,key);
+    fail_unless (g_file_test (path,G_FILE_TEST_EXISTS), NULL);
+
+    GlyrMemCache * found = glyr_db_lookup (db,&two);
+    fail_unless (found != NULL, NULL);
+    fail_unless (found->size == size, NULL);
+    fail_unless (memcmp (found->data,image->data,size) == 0, NULL);
+    glyr_free_list (found);
+
+    /* Still used by the other row */
+    fail_unless (glyr_db_delete (db,&one) == 1, NULL);
+    fail_unless (g_file_test (path,G_FILE_TEST_EXISTS), NULL);
+
+    /* A row whose file got lost is not handed out */
+    unlink (path);
+    found = glyr_db_lookup (db,&two);
+    fail_unless (found == NULL, NULL);
+
+    fail_unless (glyr_db_delete (db,&two) == 1, NULL);
+    fail_unless (g_file_test (path,G_FILE_TEST_EXISTS) == FALSE, NULL);
+
+    g_free (key);
+    g_free (path);
+    glyr_cache_free (image);
+    glyr_query_destroy (&one);
+    glyr_query_destroy (&two);
+    glyr_db_destroy (db);
+}
+END_TEST
+
+//--------------------
+
+START_TEST (test_negative_cache)
+{
+    int port = 0;
+    int proxy = listen_local (&port);
+    gchar * proxy_url = g_strdup_printf ("127.0.0.1:%d",port);
+
+    GlyrDatabase * db = setup_db();
+    glyr_db_set_miss_ttl (db,3600);
+
+    GlyrQuery q;
+    setup (&q,GLYR_GET_LYRICS,1);
+    glyr_opt_verbosity (&q,0);
+    glyr_opt_lookup_db (&q,db);
+    glyr_opt_proxy (&q,proxy_url);
+    glyr_opt_timeout (&q,1);
+
+    /* lyricswiki is skipped */
+    glyr_testing_remember_miss (db,&q,"lyricswiki");
+    glyr_opt_from (&q,"lyricswiki");
+    GlyrMemCache * list = glyr_get (&q,NULL,NULL);
+    fail_unless (list == NULL, NULL);
+    fail_unless (count_connections (proxy) == 0, NULL);
+
+    /* chartlyrics still goes online; timeouts are no misses */
+    glyr_opt_from (&q,"chartlyrics");
+    list = glyr_get (&q,NULL,NULL);
+    fail_unless (list == NULL, NULL);
+    fail_unless (count_connections (proxy) > 0, NULL);
+
+    /* So it is asked again */
+    list = glyr_get (&q,NULL,NULL);
+    fail_unless (list == NULL, NULL);
+    fail_unless (count_connections (proxy) > 0, NULL);
+
+    /* Every provider had nothing - no download at all, and no error */
+    glyr_opt_from (&q,"lyricswiki;chartlyrics");
+    glyr_testing_remember_miss (db,&q,"chartlyrics");
+    GLYR_ERROR error = GLYRE_UNKNOWN;
+    list = glyr_get (&q,&error,NULL);
+    fail_unless (list == NULL, NULL);
+    fail_unless (error == GLYRE_OK, NULL);
+    fail_unless (count_connections (proxy) == 0, NULL);
+
+    /* Other options, other misses */
+    glyr_opt_lang (&q,"de");
+    list = glyr_get (&q,NULL,NULL);
+    fail_unless (list == NULL, NULL);
+    fail_unless (count_connections (proxy) > 0, NULL);
+    glyr_opt_lang (&q,"auto");
+
+    /* Off (the default) asks everyone again */
+    glyr_db_set_miss_ttl (db,0);
+    list = glyr_get (&q,NULL,NULL);
+    fail_unless (list == NULL, NULL);
+    fail_unless (count_connections (proxy) > 0, NULL);
+
+    glyr_free_list (list);
+    glyr_query_destroy (&q);
+    glyr_db_destroy (db);
+    g_free (proxy_url);
+    close (proxy);
+}
+END_TEST
+
+//--------------------
+
+START_TEST (test_prefetch)
+{
+    GlyrQuery q;
+    setup (&q,GLYR_GET_LYRICS,1);
+    glyr_opt_verbosity (&q,0);
+    fail_unless (glyr_prefetch (&q) == GLYRE_BAD_VALUE,"Prefetching needs a db");
+
+    GlyrDatabase * db = setup_db();
+    glyr_opt_lookup_db (&q,db);
+
+    /* The second one gets merged into the first */
+    fail_unless (glyr_prefetch (&q) == GLYRE_OK,NULL);
+    fail_unless (glyr_prefetch (&q) == GLYRE_OK,NULL);
+
+    /* Waits for the prefetch and takes its results, even without db_autoread */
+    glyr_opt_db_autoread (&q,false);
+    g_usleep (G_USEC_PER_SEC / 10);
+
+    int length = 0;
+    GlyrMemCache * list = glyr_get (&q,NULL,&length);
+    fail_unless (length == 1,NULL);
+    fail_unless (list->cached == TRUE,"The item should come from the db");
+    fail_unless (count_db_items (db) == 1,NULL);
+
+    glyr_free_list (list);
+    glyr_db_destroy (db);
+    glyr_query_destroy (&q);
+}
+END_TEST
 
 //--------------------
 
@@ -364,7 +754,15 @@ Suite * create_test_suite (void)
     tcase_add_test (tc_dbcache, test_iter_db);
     tcase_add_test (tc_dbcache, test_sorted_rating);
     tcase_add_test (tc_dbcache, test_intelligent_lookup);
+    tcase_add_test (tc_dbcache, test_normalized_lookup);
     tcase_add_test (tc_dbcache, test_db_editplace);
+    tcase_add_test (tc_dbcache, test_insert_batch);
+    tcase_add_test (tc_dbcache, test_delete_many);
+    tcase_add_test (tc_dbcache, test_maintain);
+    tcase_add_test (tc_dbcache, test_parallel_lookup);
+    tcase_add_test (tc_dbcache, test_blob_store);
+    tcase_add_test (tc_dbcache, test_prefetch);
+    tcase_add_test (tc_dbcache, test_negative_cache);
     suite_add_tcase (s, tc_dbcache);
     return s;
 }
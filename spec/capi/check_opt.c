@@ -19,6 +19,11 @@
  **************************************************************/
 
 #include "test_common.h"
+#include <unistd.h>
+
+#ifdef GLYR_HAVE_PIXBUF
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#endif
 
 //--------------------
 
@@ -174,6 +179,236 @@ END_TEST
 
 //--------------------
 
+START_TEST (test_glyr_opt_priority)
+{
+    GlyrQuery q;
+    setup (&q,GLYR_GET_LYRICS,1);
+    fail_unless (q.priority == GLYR_PRIORITY_INTERACTIVE,NULL);
+    fail_unless (glyr_opt_priority (&q,42) == GLYRE_BAD_VALUE,NULL);
+    fail_unless (glyr_opt_priority (&q,GLYR_PRIORITY_BACKGROUND) == GLYRE_OK,NULL);
+
+    int length = 0;
+    GlyrMemCache * list = glyr_get (&q,NULL,&length);
+    fail_unless (length == 1,"Background queries should deliver as usual");
+
+    unsetup (&q,list);
+}
+END_TEST
+
+//--------------------
+
+/* Asks all lyrics providers at once through a proxy that never answers */
+static void setup_hanging (GlyrQuery * q, const char * proxy, int timeout)
+{
+    setup (q,GLYR_GET_LYRICS,1);
+    glyr_opt_verbosity (q,0);
+    glyr_opt_parallel (q,20);
+    glyr_opt_proxy (q,proxy);
+    glyr_opt_timeout (q,timeout);
+}
+
+static gpointer run_background_query (gpointer proxy)
+{
+    GlyrQuery q;
+    setup_hanging (&q,proxy,6);
+    glyr_opt_priority (&q,GLYR_PRIORITY_BACKGROUND);
+    unsetup (&q,glyr_get (&q,NULL,NULL) );
+    return NULL;
+}
+
+START_TEST (test_glyr_opt_priority_preempt)
+{
+    int bg_port = 0, ia_port = 0;
+    int bg_proxy = listen_local (&bg_port);
+    int ia_proxy = listen_local (&ia_port);
+    gchar * bg_url = g_strdup_printf ("127.0.0.1:%d",bg_port);
+    gchar * ia_url = g_strdup_printf ("127.0.0.1:%d",ia_port);
+
+    /* More background transfers than there are slots for them */
+    GThread * background[3];
+    for (int i = 0; i < 3; i++)
+    {
+        background[i] = g_thread_new ("background",run_background_query,bg_url);
+    }
+    g_usleep (G_USEC_PER_SEC);
+
+    /* Needs more slots than are reserved for interactive queries */
+    GlyrQuery q;
+    setup_hanging (&q,ia_url,2);
+    gint64 started = g_get_monotonic_time();
+    GlyrMemCache * list = glyr_get (&q,NULL,NULL);
+    gint64 took = g_get_monotonic_time() - started;
+
+    fail_unless (count_connections (ia_proxy) > 8,"Interactive transfers should take the slots of background ones");
+    fail_unless (took < 5 * G_USEC_PER_SEC,"Interactive query should not wait for the background ones");
+    unsetup (&q,list);
+
+    for (int i = 0; i < 3; i++)
+    {
+        g_thread_join (background[i]);
+    }
+
+    close (bg_proxy);
+    close (ia_proxy);
+    g_free (bg_url);
+    g_free (ia_url);
+}
+END_TEST
+
+//--------------------
+
+START_TEST (test_glyr_opt_autotune)
+{
+    GlyrQuery q;
+    setup (&q,GLYR_GET_LYRICS,1);
+    fail_unless (q.autotune == false,NULL);
+    fail_unless (glyr_opt_autotune (NULL,true) == GLYRE_EMPTY_STRUCT,NULL);
+    fail_unless (glyr_opt_autotune (&q,true) == GLYRE_OK,NULL);
+
+    for (int i = 0; i < 2; i++)
+    {
+        int length = 0;
+        GlyrMemCache * list = glyr_get (&q,NULL,&length);
+        fail_unless (length == 1,"Tuned queries should deliver as usual");
+        fail_unless (q.parallel == 0,"parallel should stay untouched");
+        glyr_free_list (list);
+    }
+
+    unsetup (&q,NULL);
+}
+END_TEST
+
+//--------------------
+
+START_TEST (test_glyr_opt_img_dedup)
+{
+    GlyrQuery q;
+    setup (&q,GLYR_GET_COVERART,3);
+    fail_unless (q.img_dedup == false,NULL);
+    fail_unless (glyr_opt_img_dedup (NULL,true) == GLYRE_EMPTY_STRUCT,NULL);
+    fail_unless (glyr_opt_img_dedup (&q,true) == GLYRE_OK,NULL);
+    glyr_opt_download (&q,true);
+
+    int length = 0;
+    GlyrMemCache * list = glyr_get (&q,NULL,&length);
+    fail_unless (length > 0,"Should still find covers");
+
+    for (GlyrMemCache * a = list; a; a = a->next)
+    {
+        for (GlyrMemCache * b = a->next; b; b = b->next)
+        {
+            fail_unless (memcmp (a->md5sum,b->md5sum,16) != 0,"Exact duplicates should never be returned");
+        }
+    }
+
+    unsetup (&q,list);
+}
+END_TEST
+
+//--------------------
+
+#ifdef GLYR_HAVE_PIXBUF
+
+/* Writes a picture with some structure to path, scaled to edge x edge pixels; returns the file size */
+static gsize write_test_image (const char * path, int edge)
+{
+    GdkPixbuf * image = gdk_pixbuf_new (GDK_COLORSPACE_RGB,FALSE,8,256,256);
+    guchar * pixels = gdk_pixbuf_get_pixels (image);
+    int stride = gdk_pixbuf_get_rowstride (image);
+    for (int y = 0; y < 256; y++)
+    {
+        for (int x = 0; x < 256; x++)
+        {
+            guchar * px = pixels + y * stride + x * 3;
+            px[0] = (x < 128) ? x * 2 : 255 - y;
+            px[1] = ( (x / 64 + y / 64) % 2) ? 200 : 30;
+            px[2] = y;
+        }
+    }
+
+    GdkPixbuf * scaled = gdk_pixbuf_scale_simple (image,edge,edge,GDK_INTERP_BILINEAR);
+    fail_unless (gdk_pixbuf_save (scaled,path,"png",NULL,NULL) == TRUE,NULL);
+    g_object_unref (scaled);
+    g_object_unref (image);
+
+    gchar * data = NULL;
+    gsize size = 0;
+    fail_unless (g_file_get_contents (path,&data,&size,NULL) == TRUE,NULL);
+    g_free (data);
+    return size;
+}
+
+START_TEST (test_glyr_opt_img_dedup_musictree)
+{
+    /* Two sizes of the same cover in the album dir */
+    const char * dir = "/tmp/check_img_dedup";
+    g_mkdir_with_parents (dir,0755);
+    write_test_image ("/tmp/check_img_dedup/folder.png",100);
+    gsize large_size = write_test_image ("/tmp/check_img_dedup/cover.png",240);
+
+    GlyrQuery q;
+    setup (&q,GLYR_GET_COVERART,3);
+    glyr_opt_from (&q,"musictree");
+    glyr_opt_musictree_path (&q,dir);
+    glyr_opt_img_dedup (&q,true);
+
+    int length = 0;
+    GlyrMemCache * list = glyr_get (&q,NULL,&length);
+    fail_unless (length == 1,"Only one of the copies should be returned");
+    fail_unless (list != NULL && list->size == large_size,"The larger copy should be kept");
+    unsetup (&q,list);
+
+    /* Without dedup both are there */
+    setup (&q,GLYR_GET_COVERART,3);
+    glyr_opt_from (&q,"musictree");
+    glyr_opt_musictree_path (&q,dir);
+    list = glyr_get (&q,NULL,&length);
+    fail_unless (length == 2,NULL);
+    unsetup (&q,list);
+
+    unlink ("/tmp/check_img_dedup/folder.png");
+    unlink ("/tmp/check_img_dedup/cover.png");
+    rmdir (dir);
+}
+END_TEST
+
+#endif
+
+//--------------------
+
+START_TEST (test_glyr_opt_confidence)
+{
+    GlyrQuery q;
+    setup (&q,GLYR_GET_LYRICS,4);
+    fail_unless (q.confidence == 0.0,NULL);
+    fail_unless (glyr_opt_confidence (NULL,0.5) == GLYRE_EMPTY_STRUCT,NULL);
+    fail_unless (glyr_opt_confidence (&q,-0.1) == GLYRE_BAD_VALUE,NULL);
+    fail_unless (glyr_opt_confidence (&q,1.1) == GLYRE_BAD_VALUE,NULL);
+
+    /* Without a threshold, results still come best first */
+    int length = 0;
+    GlyrMemCache * list = glyr_get (&q,NULL,&length);
+    fail_unless (length > 0,"Should find lyrics");
+    for (GlyrMemCache * item = list; item && item->next; item = item->next)
+    {
+        fail_unless (item->score >= item->next->score,"Results should be sorted by score");
+    }
+    glyr_free_list (list);
+
+    /* Any item is good enough - the search stops at the first one,
+     * one provider at a time so no other one is already underway */
+    fail_unless (glyr_opt_confidence (&q,0.01) == GLYRE_OK,NULL);
+    glyr_opt_parallel (&q,1);
+    list = glyr_get (&q,NULL,&length);
+    fail_unless (length == 1,"Should stop after the first lyrics, although 4 were wanted");
+    fail_unless (list != NULL && list->score >= 0.01,NULL);
+
+    unsetup (&q,list);
+}
+END_TEST
+
+//--------------------
+
 Suite * create_test_suite (void)
 {
     Suite *s = suite_create ("Libglyr");
@@ -186,6 +421,14 @@ Suite * create_test_suite (void)
     tcase_add_test (tc_options, test_glyr_opt_number);
     tcase_add_test (tc_options, test_glyr_opt_allowed_formats);
     tcase_add_test (tc_options, test_glyr_opt_proxy);
+    tcase_add_test (tc_options, test_glyr_opt_priority);
+    tcase_add_test (tc_options, test_glyr_opt_priority_preempt);
+    tcase_add_test (tc_options, test_glyr_opt_autotune);
+    tcase_add_test (tc_options, test_glyr_opt_img_dedup);
+#ifdef GLYR_HAVE_PIXBUF
+    tcase_add_test (tc_options, test_glyr_opt_img_dedup_musictree);
+#endif
+    tcase_add_test (tc_options, test_glyr_opt_confidence);
     suite_add_tcase (s, tc_options);
     return s;
 }
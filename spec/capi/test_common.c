@@ -20,6 +20,11 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
 #include <glib.h>
 
 #include "../../lib/glyr.h"
@@ -59,3 +64,45 @@ void init (void)
     glyr_init();
     atexit (glyr_cleanup);
 }
+
+//--------------------
+
+int listen_local (int * port)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof addr;
+    memset (&addr,0,sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+    int fd = socket (AF_INET,SOCK_STREAM,0);
+    bind (fd, (struct sockaddr *) &addr,sizeof addr);
+    listen (fd,64);
+    getsockname (fd, (struct sockaddr *) &addr,&len);
+    *port = ntohs (addr.sin_port);
+    return fd;
+}
+
+//--------------------
+
+int count_connections (int fd)
+{
+    int count = 0;
+    for (;;)
+    {
+        fd_set set;
+        FD_ZERO (&set);
+        FD_SET (fd,&set);
+        struct timeval no_wait = {0,0};
+        if (select (fd + 1,&set,NULL,NULL,&no_wait) <= 0)
+            break;
+
+        int client = accept (fd,NULL,NULL);
+        if (client < 0)
+            break;
+
+        close (client);
+        count++;
+    }
+    return count;
+}
@@ -28,3 +28,11 @@ void setup (GlyrQuery * q, GLYR_GET_TYPE type, int num);
 GlyrQuery * setup_alloc (GLYR_GET_TYPE type, int num);
 void unsetup (GlyrQuery * q, GlyrMemCache * list);
 void init (void);
+
+/* A local port that accepts connections but never answers, used as proxy:
+ * every connection to it is a download glyr tried
+ */
+int listen_local (int * port);
+
+/* Connections made to fd since the last call; they are closed */
+int count_connections (int fd);